@@ -0,0 +1,692 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "align.h"
+#include "fileio.h"
+#include "compare.h"
+#include "diffmap.h"
+#include "job.h"
+#include "gui.h"
+
+/* Files are aligned the way rsync finds the parts of a file that another
+   one has already. File one is cut into blocks, and the weak checksum of
+   each block goes into a table. A window the size of a block then slides
+   over file two a byte at a time, its checksum rolled along in constant
+   time. Wherever the checksum is found in the table, the bytes are
+   compared; a match anchors file two to file one there, and the window
+   jumps past it. Anchors are only taken in order in both files, so that
+   they tell insertions and deletions apart rather than moved data, and
+   are then stretched over the bytes around them that still match. Each
+   file is read through about twice, whatever the differences. */
+
+#define NO_BLOCK (~0UL)
+
+/* The blocks of file one, hashed by checksum. */
+struct block_table {
+	unsigned long block_size;    /* Bytes in each block               */
+	unsigned long count;         /* Whole blocks in file one          */
+	unsigned long *checksums;    /* Checksum of each block            */
+	unsigned long *next;         /* Next block in the same bucket     */
+	unsigned long *buckets;      /* First block of each bucket        */
+	unsigned long mask;          /* Number of buckets, less one       */
+};
+
+/* Weak checksum of a window, as in rsync: a is the sum of its bytes, and
+   b the sum of the successive values of a. Both are only kept modulo
+   2^16 in the end, so they may wrap around. */
+struct checksum {
+	unsigned long a;
+	unsigned long b;
+};
+
+/* What the alignment is built with. */
+struct aligner {
+	struct file_view view_one;   /* Reads file one at random          */
+	struct file_view view_two;   /* Reads file two at random          */
+	struct block_table table;
+	struct job *job;             /* Job to report progress to, or NULL */
+	int cancelled;               /* The job asked to give up          */
+	struct alignment *alignment; /* Segments found so far             */
+	unsigned long capacity;      /* Room for segments                 */
+	hex_offset end_one;          /* End of the last anchor, in one    */
+	hex_offset end_two;          /* ... and in two                    */
+};
+
+/* #####################################################################
+   ##                     ROLLING CHECKSUMS                           ##
+   ##################################################################### */
+
+static void add_bytes(struct checksum *sum, const unsigned char *data,
+                      unsigned long length)
+{
+	unsigned long i;
+
+	for (i = 0; i < length; i++) {
+		sum->a += data[i];
+		sum->b += sum->a;
+	}
+}
+
+/* Slides a window of length bytes by one byte: out leaves it, and in
+   comes in at its end. */
+static void roll_checksum(struct checksum *sum, unsigned char out,
+                          unsigned char in, unsigned long length)
+{
+	sum->a += in - (unsigned long) out;
+	sum->b += sum->a - length * out;
+}
+
+static unsigned long checksum_value(struct checksum *sum)
+{
+	return (sum->a & 0xffff) | ((sum->b & 0xffff) << 16);
+}
+
+static unsigned long bucket(struct block_table *table, unsigned long value)
+{
+	return ((value ^ (value >> 16)) * 2654435761UL) & table->mask;
+}
+
+/* #####################################################################
+   ##                   COMPARING STRETCHES                           ##
+   ##################################################################### */
+
+/* Number of equal bytes at the start of both files from one and two on,
+   up to limit. */
+static hex_offset match_forward(struct aligner *aligner, hex_offset one,
+                                hex_offset two, hex_offset limit)
+{
+	unsigned char piece_one[ALIGN_PIECE], piece_two[ALIGN_PIECE];
+	unsigned long length, read_one, read_two, equal;
+	hex_offset matched = 0;
+
+	while (matched < limit) {
+		length = (limit - matched < ALIGN_PIECE)
+		         ? (unsigned long) (limit - matched) : ALIGN_PIECE;
+		read_one = copy_view(&aligner->view_one, one + matched,
+		                     piece_one, length);
+		read_two = copy_view(&aligner->view_two, two + matched,
+		                     piece_two, length);
+		if (read_two < read_one) read_one = read_two;
+		equal = find_mismatch(piece_one, piece_two, read_one);
+		matched += equal;
+		if (equal < length) break;
+	}
+
+	return matched;
+}
+
+/* Number of equal bytes just before one and two, up to limit. */
+static hex_offset match_backward(struct aligner *aligner, hex_offset one,
+                                 hex_offset two, hex_offset limit)
+{
+	unsigned char piece_one[ALIGN_PIECE], piece_two[ALIGN_PIECE];
+	unsigned long length, read_one, read_two, i;
+	hex_offset matched = 0;
+
+	while (matched < limit) {
+		length = (limit - matched < ALIGN_PIECE)
+		         ? (unsigned long) (limit - matched) : ALIGN_PIECE;
+		read_one = copy_view(&aligner->view_one, one - matched - length,
+		                     piece_one, length);
+		read_two = copy_view(&aligner->view_two, two - matched - length,
+		                     piece_two, length);
+		if (read_one < length || read_two < length) break;
+		for (i = length; i > 0 && piece_one[i - 1] == piece_two[i - 1];
+		     i--);
+		matched += length - i;
+		if (i > 0) break;
+	}
+
+	return matched;
+}
+
+/* #####################################################################
+   ##                   TABLE OF FILE ONE                             ##
+   ##################################################################### */
+
+/* Cuts file one into blocks, small enough to anchor what lies between
+   nearby insertions, but few enough that the table stays small. Returns
+   1 if there is not enough memory. */
+static int build_table(struct aligner *aligner, struct file *file)
+{
+	struct block_table *table = &aligner->table;
+	struct file_view view;
+	struct checksum sum;
+	const unsigned char *data;
+	unsigned long block, available, buckets, value;
+	hex_offset offset, end;
+
+	table->block_size = ALIGN_MIN_BLOCK;
+	while (file->size / table->block_size > ALIGN_MAX_BLOCKS)
+		table->block_size *= 2;
+	table->count = (unsigned long) (file->size / table->block_size);
+	for (buckets = 1; buckets < table->count; buckets *= 2);
+	table->mask = buckets - 1;
+
+	table->checksums = malloc(sizeof(unsigned long) * (table->count + 1));
+	table->next = malloc(sizeof(unsigned long) * (table->count + 1));
+	table->buckets = malloc(sizeof(unsigned long) * buckets);
+	if (table->checksums == NULL || table->next == NULL ||
+	    table->buckets == NULL) return 1;
+	memset(table->buckets, 0xff, sizeof(unsigned long) * buckets);
+
+	init_view(&view, file, ALIGN_BUFFER, ADVISE_SEQUENTIAL);
+	advise_file(file, 0, file->size, ADVISE_SEQUENTIAL);
+	for (block = 0; block < table->count; block++) {
+		sum.a = sum.b = 0;
+		offset = (hex_offset) block * table->block_size;
+		end = offset + table->block_size;
+		while (offset < end) {
+			data = read_view(&view, offset, end - offset,
+			                 &available);
+			if (available == 0) break;
+			add_bytes(&sum, data, available);
+			offset += available;
+		}
+
+		/* Blocks go ahead of the ones after them in their bucket. */
+		value = checksum_value(&sum);
+		table->checksums[block] = value;
+		table->next[block] = table->buckets[bucket(table, value)];
+		table->buckets[bucket(table, value)] = block;
+
+		if (advance_job(aligner->job, table->block_size)) {
+			aligner->cancelled = 1;
+			break;
+		}
+	}
+	free_view(&view);
+
+	return 0;
+}
+
+static void free_table(struct block_table *table)
+{
+	free(table->checksums);
+	free(table->next);
+	free(table->buckets);
+}
+
+/* #####################################################################
+   ##                       FINDING ANCHORS                           ##
+   ##################################################################### */
+
+/* Tells whether a block of file one holds what file two does at two. */
+static int block_matches(struct aligner *aligner, unsigned long block,
+                         unsigned long value, hex_offset two)
+{
+	struct block_table *table = &aligner->table;
+
+	return (block < table->count && table->checksums[block] == value &&
+	        (hex_offset) block * table->block_size >= aligner->end_one &&
+	        match_forward(aligner, (hex_offset) block * table->block_size,
+	                      two, table->block_size) == table->block_size);
+}
+
+/* Looks for a block of file one that the window of file two at two
+   holds, and that comes after the last anchor. The blocks around the
+   offset that would carry on the current alignment are tried first, as
+   they are where a small insertion or deletion leads. Otherwise, of the
+   first few blocks with the same checksum, the one nearest to that offset
+   is taken. Returns 0 if there is none. */
+static int find_block(struct aligner *aligner, unsigned long value,
+                      hex_offset two, hex_offset *found)
+{
+	struct block_table *table = &aligner->table;
+	hex_offset expected = aligner->end_one + (two - aligner->end_two);
+	hex_offset offset, distance, best_distance = 0;
+	unsigned long block, tried = 0;
+	int any = 0;
+
+	block = (unsigned long) (expected / table->block_size);
+	if (block_matches(aligner, block, value, two) ||
+	    (expected % table->block_size != 0 &&
+	     block_matches(aligner, ++block, value, two))) {
+		*found = (hex_offset) block * table->block_size;
+		return 1;
+	}
+
+	/* Blocks come in a bucket from the last one to the first. */
+	for (block = table->buckets[bucket(table, value)];
+	     block != NO_BLOCK && tried < ALIGN_CANDIDATES;
+	     block = table->next[block]) {
+		offset = (hex_offset) block * table->block_size;
+		if (offset < aligner->end_one) break;
+		if (table->checksums[block] != value) continue;
+		tried++;
+		distance = (offset > expected) ? offset - expected
+		           : expected - offset;
+		if (any && distance >= best_distance) continue;
+		if (!block_matches(aligner, block, value, two)) continue;
+		*found = offset;
+		best_distance = distance;
+		any = 1;
+	}
+
+	return any;
+}
+
+/* Adds a segment after the others, joining it with the last one if they
+   carry on from each other. */
+static void add_segment(struct aligner *aligner, hex_offset one,
+                        hex_offset two, hex_offset length)
+{
+	struct alignment *alignment = aligner->alignment;
+	struct align_segment *last;
+
+	if (alignment->count > 0) {
+		last = &alignment->segments[alignment->count - 1];
+		if (last->one + last->length == one &&
+		    last->two + last->length == two) {
+			last->length += length;
+			return;
+		}
+	}
+
+	if (alignment->count == aligner->capacity) {
+		aligner->capacity *= 2;
+		alignment->segments = realloc(alignment->segments,
+		                              sizeof(struct align_segment) *
+		                              aligner->capacity);
+	}
+	last = &alignment->segments[alignment->count++];
+	last->one = one;
+	last->two = two;
+	last->length = length;
+}
+
+/* Slides the window over file two, and anchors it wherever it matches a
+   block of file one. The window and the byte after it are kept in a
+   buffer that file two is read into a large piece at a time. */
+static void find_anchors(struct aligner *aligner, struct file *file_two)
+{
+	unsigned long size = aligner->table.block_size;
+	unsigned long capacity = (ALIGN_BUFFER > 4 * size) ? ALIGN_BUFFER
+	                         : 4 * size;
+	unsigned char *buffer = malloc(capacity), *window;
+	unsigned long filled = 0, kept;
+	hex_offset base = 0, two = 0, one;
+	struct checksum sum;
+	int rolling = 0;
+
+	if (buffer == NULL || aligner->table.count == 0) {
+		free(buffer);
+		return;
+	}
+
+	advise_file(file_two, 0, file_two->size, ADVISE_SEQUENTIAL);
+	while (two + size <= file_two->size) {
+		/* Read on once the byte after the window is past the
+		   buffer. */
+		if (two + size >= base + filled) {
+			kept = (unsigned long) (base + filled - two);
+			memmove(buffer, buffer + (two - base), kept);
+			base = two;
+			filled = kept + copy_view(&aligner->view_two,
+			                          base + kept, buffer + kept,
+			                          capacity - kept);
+			if (advance_job(aligner->job, filled - kept)) {
+				aligner->cancelled = 1;
+				break;
+			}
+			if (two + size > base + filled) break;
+		}
+		window = buffer + (two - base);
+
+		if (!rolling) {
+			sum.a = sum.b = 0;
+			add_bytes(&sum, window, size);
+			rolling = 1;
+		}
+
+		if (find_block(aligner, checksum_value(&sum), two, &one)) {
+			add_segment(aligner, one, two, size);
+			aligner->end_one = one + size;
+			aligner->end_two = two + size;
+			two += size;
+			rolling = 0;
+			continue;
+		}
+
+		if (two + size == base + filled) break;
+		roll_checksum(&sum, window[0], window[size], size);
+		two++;
+	}
+
+	free(buffer);
+}
+
+/* #####################################################################
+   ##                    STRETCHING ANCHORS                           ##
+   ##################################################################### */
+
+/* Number of bytes of file one that are skipped in going from segment a
+   to segment b, where b is further behind in file two than a is. */
+static hex_offset skipped_bytes(struct align_segment *a,
+                                struct align_segment *b)
+{
+	if (a->two + b->one > b->two + a->one)
+		return (a->two + b->one) - (b->two + a->one);
+	return 0;
+}
+
+/* Stretches every segment over all the equal bytes around it. Stretched
+   that way, segments overlap where the bytes would line up either way,
+   as in runs of padding; which one is followed where is then picked
+   going through them in order: a segment is dropped if the next one does
+   all it does, or if the one after it takes over before it started, and
+   the ones kept hand over where the first of them ends. Empty segments
+   at the start and the end of the files take in what both files begin
+   and end with. */
+static void stretch_segments(struct aligner *aligner)
+{
+	struct alignment *alignment = aligner->alignment;
+	struct align_segment *runs, *run, *last, *next;
+	unsigned long count, kept, i, *picked;
+	hex_offset *starts, start, end, matched;
+
+	count = alignment->count + 2;
+	runs = malloc(sizeof(struct align_segment) * count);
+	picked = malloc(sizeof(unsigned long) * count);
+	starts = malloc(sizeof(hex_offset) * count);
+	if (runs == NULL || picked == NULL || starts == NULL) {
+		free(runs);
+		free(picked);
+		free(starts);
+		return;
+	}
+	runs[0].one = runs[0].two = runs[0].length = 0;
+	memcpy(runs + 1, alignment->segments,
+	       sizeof(struct align_segment) * alignment->count);
+	runs[count - 1].one = alignment->size_one;
+	runs[count - 1].two = alignment->size_two;
+	runs[count - 1].length = 0;
+
+	for (i = 0; i < count; i++) {
+		run = &runs[i];
+		matched = match_backward(aligner, run->one, run->two,
+		                         (run->one < run->two) ? run->one
+		                         : run->two);
+		run->one -= matched;
+		run->two -= matched;
+		run->length += matched;
+		end = alignment->size_one - (run->one + run->length);
+		if (alignment->size_two - (run->two + run->length) < end)
+			end = alignment->size_two - (run->two + run->length);
+		run->length += match_forward(aligner, run->one + run->length,
+		                             run->two + run->length, end);
+	}
+
+	kept = 0;
+	for (i = 0; i < count; i++) {
+		run = &runs[i];
+
+		/* Take over from the last segment kept as late as possible,
+		   dropping it if it would be left with nothing. */
+		for (;;) {
+			start = run->one;
+			if (kept == 0) break;
+			last = &runs[picked[kept - 1]];
+			if (start < last->one + last->length +
+			            skipped_bytes(last, run))
+				start = last->one + last->length +
+				        skipped_bytes(last, run);
+			if (start >= run->one + run->length) break;
+			if (start - skipped_bytes(last, run) > starts[kept - 1])
+				break;
+			kept--;
+		}
+		if (start >= run->one + run->length) continue;
+		if (i + 1 < count && runs[i + 1].one <= start &&
+		    runs[i + 1].one + runs[i + 1].length >=
+		    run->one + run->length) continue;
+
+		picked[kept] = i;
+		starts[kept] = start;
+		kept++;
+	}
+
+	/* Each segment kept ends where the next one takes over. */
+	alignment->count = 0;
+	for (i = 0; i < kept; i++) {
+		run = &runs[picked[i]];
+		end = run->one + run->length;
+		if (i + 1 < kept) {
+			next = &runs[picked[i + 1]];
+			if (starts[i + 1] - skipped_bytes(run, next) < end)
+				end = starts[i + 1] - skipped_bytes(run, next);
+		}
+		add_segment(aligner, starts[i],
+		            run->two + (starts[i] - run->one), end - starts[i]);
+	}
+
+	free(runs);
+	free(picked);
+	free(starts);
+}
+
+/* #####################################################################
+   ##                     BUILDING ALIGNMENTS                         ##
+   ##################################################################### */
+
+/* Works out how file two lines up with file one, reporting its progress
+   to job unless it is NULL. Returns NULL if there is not enough memory
+   for it, or if the job asked it to give up. */
+struct alignment *align_files(struct file *file_one, struct file *file_two,
+                              struct job *job)
+{
+	struct aligner aligner;
+	struct alignment *alignment = malloc(sizeof(struct alignment));
+
+	if (alignment == NULL) return NULL;
+	alignment->size_one = file_one->size;
+	alignment->size_two = file_two->size;
+	alignment->count = 0;
+	aligner.capacity = 64;
+	alignment->segments = malloc(sizeof(struct align_segment) *
+	                             aligner.capacity);
+	aligner.alignment = alignment;
+	aligner.end_one = aligner.end_two = 0;
+	aligner.job = job;
+	aligner.cancelled = 0;
+
+	if (alignment->segments == NULL) {
+		free_alignment(alignment);
+		return NULL;
+	}
+	if (build_table(&aligner, file_one) != 0) {
+		free_table(&aligner.table);
+		free_alignment(alignment);
+		return NULL;
+	}
+
+	init_view(&aligner.view_one, file_one, ALIGN_PIECE, ADVISE_RANDOM);
+	init_view(&aligner.view_two, file_two, ALIGN_BUFFER, ADVISE_RANDOM);
+	if (!aligner.cancelled) find_anchors(&aligner, file_two);
+	free_table(&aligner.table);
+	if (!aligner.cancelled) stretch_segments(&aligner);
+	free_view(&aligner.view_one);
+	free_view(&aligner.view_two);
+
+	/* The files will now be read at random. */
+	advise_file(file_one, 0, file_one->size, ADVISE_RANDOM);
+	advise_file(file_two, 0, file_two->size, ADVISE_RANDOM);
+	if (aligner.cancelled) {
+		free_alignment(alignment);
+		return NULL;
+	}
+	return alignment;
+}
+
+void free_alignment(struct alignment *alignment)
+{
+	if (alignment == NULL) return;
+	free(alignment->segments);
+	free(alignment);
+}
+
+/* #####################################################################
+   ##                     USING ALIGNMENTS                            ##
+   ##################################################################### */
+
+/* Index of the first segment that starts after offset in file one, or
+   count if there is none. */
+static unsigned long find_segment(struct alignment *alignment,
+                                  hex_offset offset)
+{
+	unsigned long low = 0, high = alignment->count;
+
+	while (low < high) {
+		unsigned long middle = low + (high - low) / 2;
+		if (alignment->segments[middle].one > offset) high = middle;
+		else low = middle + 1;
+	}
+
+	return low;
+}
+
+/* Offset in file two that lines up with offset in file one. Past the end
+   of a segment, the files are taken to go on side by side. */
+hex_offset aligned_offset(struct alignment *alignment, hex_offset offset)
+{
+	struct align_segment *segment;
+	unsigned long i = find_segment(alignment, offset);
+
+	if (alignment->count == 0) return offset;
+	segment = &alignment->segments[(i > 0) ? i - 1 : 0];
+	if (offset + segment->two < segment->one) return 0;
+	return offset + segment->two - segment->one;
+}
+
+/* Where the gap before segment i starts in file one. Gap count is the
+   one after the last segment. */
+static hex_offset gap_start(struct alignment *alignment, unsigned long i)
+{
+	struct align_segment *segment;
+
+	if (i == 0) return 0;
+	segment = &alignment->segments[i - 1];
+	return segment->one + segment->length;
+}
+
+/* Tells whether either file holds anything in the gap before segment
+   i. */
+static int gap_differs(struct alignment *alignment, unsigned long i)
+{
+	hex_offset end_one = alignment->size_one;
+	hex_offset end_two = alignment->size_two;
+	hex_offset start_two = 0;
+
+	if (i < alignment->count) {
+		end_one = alignment->segments[i].one;
+		end_two = alignment->segments[i].two;
+	}
+	if (i > 0)
+		start_two = alignment->segments[i - 1].two +
+		            alignment->segments[i - 1].length;
+	return (end_one > gap_start(alignment, i) || end_two > start_two);
+}
+
+/* Finds the first gap between segments that starts after offset in file
+   one, and sets *found to its start. Returns 0 if there is none. */
+int next_gap(struct alignment *alignment, hex_offset offset,
+             hex_offset *found)
+{
+	unsigned long i;
+
+	/* The gaps before the segment offset falls in start before it. */
+	for (i = find_segment(alignment, offset); i <= alignment->count;
+	     i++) {
+		if (gap_start(alignment, i) > offset &&
+		    gap_differs(alignment, i)) {
+			*found = gap_start(alignment, i);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Finds the last gap between segments that starts before offset in file
+   one, and sets *found to its start. Returns 0 if there is none. */
+int previous_gap(struct alignment *alignment, hex_offset offset,
+                 hex_offset *found)
+{
+	unsigned long i = find_segment(alignment, offset) + 1;
+
+	/* The gaps after the segment offset falls in start after it. */
+	while (i-- > 0) {
+		if (gap_start(alignment, i) < offset &&
+		    gap_differs(alignment, i)) {
+			*found = gap_start(alignment, i);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Fills in the blocks of the overview from the alignment: a block is the
+   same if the segments cover all of it, and is shaded by the bytes they
+   leave out otherwise. Bytes that file two has in addition, between two
+   bytes of the block, count as one. */
+void align_blocks(struct alignment *alignment, char *block_cache,
+                  int total_blocks, hex_offset bytes_per_block,
+                  int blocks_with_excess_byte)
+{
+	struct align_segment *segment;
+	hex_offset start, end, first, last, covered;
+	unsigned long i = 0, j, inserted;
+	int block;
+
+	for (block = 0; block < total_blocks; block++) {
+		start = block_offset(block, bytes_per_block,
+		                     blocks_with_excess_byte);
+		end = block_offset(block + 1, bytes_per_block,
+		                   blocks_with_excess_byte);
+		if (end == start) {
+			block_cache[block] = BLOCK_EMPTY;
+			continue;
+		}
+
+		/* Segments come in order: skip those that end before the
+		   block. */
+		while (i < alignment->count && alignment->segments[i].one +
+		       alignment->segments[i].length <= start) i++;
+
+		covered = 0;
+		inserted = 0;
+		for (j = i; j < alignment->count &&
+		     alignment->segments[j].one < end; j++) {
+			segment = &alignment->segments[j];
+			first = (segment->one > start) ? segment->one : start;
+			last = segment->one + segment->length;
+			if (last > end) last = end;
+			covered += last - first;
+			if (segment->one >= start &&
+			    gap_start(alignment, j) == segment->one &&
+			    gap_differs(alignment, j))
+				inserted++;
+		}
+
+		if (covered == end - start && inserted == 0)
+			block_cache[block] = BLOCK_SAME;
+		else
+			block_cache[block] = heat_level(end - start - covered +
+			                                inserted, end - start);
+	}
+}
@@ -0,0 +1,60 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HEX_ALIGN
+#define HEX_ALIGN
+
+#include "general.h"
+
+#define ALIGN_MIN_BLOCK 1024UL  /* Smallest block of file one matched */
+#define ALIGN_MAX_BLOCKS (1UL << 20) /* Most blocks file one is cut in */
+#define ALIGN_BUFFER (1024UL * 1024) /* Bytes of file two read at once */
+#define ALIGN_PIECE 4096UL      /* Bytes compared at a time           */
+#define ALIGN_CANDIDATES 16     /* Blocks tried for a window, at most */
+
+/* A stretch that both files have in common: file two holds the length
+   bytes that file one has from one on, from two on. */
+struct align_segment {
+	hex_offset one;
+	hex_offset two;
+	hex_offset length;
+};
+
+/* How the bytes of file two line up with those of file one when bytes
+   were inserted or deleted. The segments come in order in both files, and
+   do not overlap. What lies between them differs. */
+struct alignment {
+	struct align_segment *segments;
+	unsigned long count;
+	hex_offset size_one;
+	hex_offset size_two;
+};
+
+struct job;
+
+struct alignment *align_files(struct file *file_one, struct file *file_two,
+                              struct job *job);
+void free_alignment(struct alignment *alignment);
+hex_offset aligned_offset(struct alignment *alignment, hex_offset offset);
+int next_gap(struct alignment *alignment, hex_offset offset,
+             hex_offset *found);
+int previous_gap(struct alignment *alignment, hex_offset offset,
+                 hex_offset *found);
+void align_blocks(struct alignment *alignment, char *block_cache,
+                  int total_blocks, hex_offset bytes_per_block,
+                  int blocks_with_excess_byte);
+
+#endif
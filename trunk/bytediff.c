@@ -0,0 +1,396 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include "bytediff.h"
+#include "fileio.h"
+#include "compare.h"
+
+/* The bytes around the hex view are diffed with Myers' O(ND) algorithm.
+   Where both windows start and end alike is set aside first, which is
+   most of them when the files line up there. For each number of edits d
+   in turn, the furthest any path with d edits gets along each diagonal
+   is then worked out, following runs of equal bytes for free, until one
+   of them reaches the end of both windows. Those furthest points are
+   kept for every d, which is what the path is traced back from; this
+   takes memory in the square of the edits, hence EDIT_MAX_EDITS. The
+   time it takes grows with the edits times the length of the windows,
+   hence EDIT_BUDGET. */
+
+/* What a diff is worked out with. */
+struct differ {
+	const unsigned char *one;    /* What is left of each window       */
+	const unsigned char *two;
+	long n;                      /* Bytes in what is left of one      */
+	long m;                      /* ... and of two                    */
+	unsigned long *trace;        /* Furthest points for every d       */
+	unsigned long capacity;      /* Room in the trace                 */
+	struct edit_run *snakes;     /* Runs of equal bytes on the path   */
+	unsigned long count;         /* Number of those                   */
+};
+
+/* #####################################################################
+   ##                     FINDING THE EDITS                           ##
+   ##################################################################### */
+
+/* Where the furthest points for d edits start in the trace. Only the
+   diagonals -d, -d + 2, ..., d can be reached with d edits. */
+#define TRACE_BASE(d) ((unsigned long) (d) * ((d) + 1) / 2)
+#define TRACE_AT(d, k) (TRACE_BASE(d) + ((k) + (d)) / 2)
+
+/* Keeps the furthest points reached with d edits. Returns 0 when out of
+   memory. */
+static int keep_trace(struct differ *differ, const unsigned long *v,
+                      long d)
+{
+	unsigned long needed = TRACE_BASE(d + 1);
+	long k;
+
+	if (needed > differ->capacity) {
+		unsigned long capacity = differ->capacity * 2;
+		unsigned long *trace;
+
+		if (capacity < needed) capacity = needed;
+		trace = realloc(differ->trace,
+		                sizeof(unsigned long) * capacity);
+		if (trace == NULL) return 0;
+		differ->trace = trace;
+		differ->capacity = capacity;
+	}
+	for (k = -d; k <= d; k += 2)
+		differ->trace[TRACE_AT(d, k)] = v[k + EDIT_MAX_EDITS + 1];
+	return 1;
+}
+
+/* Walks forward with d = 0, 1, ... edits until the end of both windows
+   is reached. Beyond the windows nothing matches, so a path may stray
+   out of them, but the first one to reach their end never does. Returns
+   the number of edits, or -1 when the diff gives up. */
+static long find_edits(struct differ *differ)
+{
+	unsigned long v[2 * EDIT_MAX_EDITS + 3];
+	long n = differ->n, m = differ->m, work = 0, d, k;
+
+	/* Diagonal k is stored at k + EDIT_MAX_EDITS + 1. */
+	v[EDIT_MAX_EDITS + 2] = 0;
+	for (d = 0; d <= EDIT_MAX_EDITS; d++) {
+		for (k = -d; k <= d; k += 2) {
+			unsigned long *here = &v[k + EDIT_MAX_EDITS + 1];
+			long x, y;
+
+			/* Come down from diagonal k + 1, or across from
+			   k - 1, whichever got further. */
+			if (k == -d || (k != d && here[-1] < here[1]))
+				x = here[1];
+			else
+				x = here[-1] + 1;
+			y = x - k;
+			if (x < n && y < m) {
+				long left = (n - x < m - y) ? n - x : m - y;
+				long equal;
+
+				equal = find_mismatch(differ->one + x,
+				                      differ->two + y, left);
+				x += equal;
+				work += equal;
+			}
+			*here = x;
+			work++;
+		}
+		if (!keep_trace(differ, v, d)) return -1;
+		if (n - m >= -d && n - m <= d && (n - m + d) % 2 == 0 &&
+		    (long) v[n - m + EDIT_MAX_EDITS + 1] >= n)
+			return d;
+		if (work > EDIT_BUDGET) return -1;
+	}
+	return -1;
+}
+
+/* Traces the path with the given number of edits back from the end of
+   both windows, and keeps the runs of equal bytes along it, from the
+   last to the first. Returns 0 when out of memory. */
+static int trace_back(struct differ *differ, long edits)
+{
+	long x = differ->n, y = differ->m, d, k;
+
+	differ->snakes = malloc(sizeof(struct edit_run) * (edits + 1));
+	if (differ->snakes == NULL) return 0;
+	differ->count = 0;
+
+	for (d = edits; d >= 0; d--) {
+		long previous_k, previous_x, start_x;
+
+		k = x - y;
+		if (d == 0) {
+			previous_k = k;
+			previous_x = 0;
+			start_x = 0;
+		} else {
+			const unsigned long *last = differ->trace;
+
+			/* Take the same turn the walk forward did. */
+			if (k == -d || (k != d && last[TRACE_AT(d - 1, k - 1)]
+			                < last[TRACE_AT(d - 1, k + 1)]))
+				previous_k = k + 1;
+			else
+				previous_k = k - 1;
+			previous_x = last[TRACE_AT(d - 1, previous_k)];
+			start_x = (previous_k == k + 1) ? previous_x
+			          : previous_x + 1;
+		}
+		if (x > start_x) {
+			struct edit_run *snake = &differ->snakes[differ->count];
+
+			differ->count++;
+			snake->type = EDIT_SAME;
+			snake->one = start_x;
+			snake->two = start_x - k;
+			snake->length = x - start_x;
+		}
+		x = previous_x;
+		y = previous_x - previous_k;
+	}
+	return 1;
+}
+
+/* #####################################################################
+   ##                     BUILDING THE RUNS                           ##
+   ##################################################################### */
+
+/* Adds a run of the edit script, merging it into the last one where
+   both are runs of equal bytes. */
+static void add_run(struct byte_diff *diff, int type, unsigned long one,
+                    unsigned long two, unsigned long length)
+{
+	struct edit_run *run;
+
+	if (length == 0) return;
+	if (type == EDIT_SAME && diff->count > 0 &&
+	    diff->runs[diff->count - 1].type == EDIT_SAME) {
+		diff->runs[diff->count - 1].length += length;
+		return;
+	}
+	run = &diff->runs[diff->count++];
+	run->type = type;
+	run->one = one;
+	run->two = two;
+	run->length = length;
+}
+
+/* Turns the runs of equal bytes found between the common start and end
+   of the windows into the edit script. Whatever lies between two of
+   them is shown as changed bytes as far as both files have some, and
+   as deleted or inserted bytes beyond. Returns 0 when out of memory. */
+static int build_runs(struct byte_diff *diff, struct differ *differ,
+                      unsigned long prefix)
+{
+	unsigned long one = 0, two = 0, i;
+
+	diff->runs = malloc(sizeof(struct edit_run) *
+	                    (3 * differ->count + 5));
+	if (diff->runs == NULL) return 0;
+	diff->count = 0;
+
+	add_run(diff, EDIT_SAME, 0, 0, prefix);
+	for (i = differ->count + 1; i-- > 0;) {
+		unsigned long next_one = differ->n, next_two = differ->m;
+		unsigned long changed, length = 0;
+
+		/* The snakes were kept from the last to the first; the end
+		   of both windows comes after all of them. */
+		if (i > 0) {
+			next_one = differ->snakes[i - 1].one;
+			next_two = differ->snakes[i - 1].two;
+			length = differ->snakes[i - 1].length;
+		}
+		changed = next_one - one;
+		if (changed > next_two - two) changed = next_two - two;
+		add_run(diff, EDIT_CHANGE, prefix + one, prefix + two,
+		        changed);
+		add_run(diff, EDIT_DELETE, prefix + one + changed,
+		        prefix + two + changed, next_one - one - changed);
+		add_run(diff, EDIT_INSERT, prefix + next_one,
+		        prefix + two + changed, next_two - two - changed);
+		add_run(diff, EDIT_SAME, prefix + next_one, prefix + next_two,
+		        length);
+		one = next_one + length;
+		two = next_two + length;
+	}
+	add_run(diff, EDIT_SAME, prefix + one, prefix + two,
+	        diff->length_one - prefix - one);
+	return 1;
+}
+
+/* #####################################################################
+   ##                       DIFFING A WINDOW                          ##
+   ##################################################################### */
+
+/* Works out the edits between the windows of a diff. Returns 0 when out
+   of memory; a diff that gives up is only left incomplete. */
+static int diff_bytes(struct byte_diff *diff)
+{
+	struct differ differ;
+	unsigned long shorter, prefix, suffix = 0;
+	long edits;
+	int done = 1;
+
+	shorter = (diff->length_one < diff->length_two) ? diff->length_one
+	          : diff->length_two;
+	prefix = find_mismatch(diff->data_one, diff->data_two, shorter);
+	while (suffix < shorter - prefix &&
+	       diff->data_one[diff->length_one - suffix - 1] ==
+	       diff->data_two[diff->length_two - suffix - 1])
+		suffix++;
+
+	differ.one = diff->data_one + prefix;
+	differ.two = diff->data_two + prefix;
+	differ.n = diff->length_one - prefix - suffix;
+	differ.m = diff->length_two - prefix - suffix;
+	differ.trace = NULL;
+	differ.capacity = 0;
+	differ.snakes = NULL;
+	differ.count = 0;
+
+	edits = find_edits(&differ);
+	if (edits >= 0) {
+		done = trace_back(&differ, edits) &&
+		       build_runs(diff, &differ, prefix);
+		diff->complete = done;
+	}
+	free(differ.trace);
+	free(differ.snakes);
+	return done;
+}
+
+/* Diffs up to EDIT_WINDOW bytes of file one from offset one on against
+   as many of file two from offset two on. Returns NULL when out of
+   memory. */
+struct byte_diff *diff_window(struct file_view *view_one,
+                              struct file_view *view_two, hex_offset one,
+                              hex_offset two)
+{
+	struct byte_diff *diff = malloc(sizeof(struct byte_diff));
+
+	if (diff == NULL) return NULL;
+	diff->start_one = one;
+	diff->start_two = two;
+	diff->data_one = malloc(EDIT_WINDOW);
+	diff->data_two = malloc(EDIT_WINDOW);
+	diff->runs = NULL;
+	diff->count = 0;
+	diff->complete = 0;
+	if (diff->data_one == NULL || diff->data_two == NULL) {
+		free_byte_diff(diff);
+		return NULL;
+	}
+
+	diff->length_one = copy_view(view_one, one, diff->data_one,
+	                             EDIT_WINDOW);
+	diff->length_two = copy_view(view_two, two, diff->data_two,
+	                             EDIT_WINDOW);
+	if (!diff_bytes(diff)) {
+		free_byte_diff(diff);
+		return NULL;
+	}
+	return diff;
+}
+
+void free_byte_diff(struct byte_diff *diff)
+{
+	if (diff == NULL) return;
+	free(diff->data_one);
+	free(diff->data_two);
+	free(diff->runs);
+	free(diff);
+}
+
+/* Tells whether a diff can still be shown from offset on in file one.
+   Towards the end of a window, the edits are only as good as where it
+   was cut, so a diff is redone once halfway through it, unless file one
+   ended within it. */
+int diff_covers(struct byte_diff *diff, hex_offset offset)
+{
+	hex_offset reach = EDIT_WINDOW / 2;
+
+	if (diff->length_one < EDIT_WINDOW) reach = diff->length_one + 1;
+	return (offset >= diff->start_one &&
+	        offset - diff->start_one < reach);
+}
+
+/* #####################################################################
+   ##                     WALKING THE EDITS                           ##
+   ##################################################################### */
+
+/* Puts the cursor on the byte of file one at offset, or on the bytes
+   inserted before it. Returns 0 if the diff does not reach there. */
+int seek_edit(struct byte_diff *diff, hex_offset offset,
+              struct edit_cursor *cursor)
+{
+	unsigned long i;
+	hex_offset where;
+
+	cursor->run = diff->count;
+	cursor->step = 0;
+	if (offset < diff->start_one) return 0;
+	where = offset - diff->start_one;
+
+	for (i = 0; i < diff->count; i++) {
+		struct edit_run *run = &diff->runs[i];
+
+		if (run->type == EDIT_INSERT ? where == run->one
+		    : where < run->one + run->length) {
+			cursor->run = i;
+			if (run->type != EDIT_INSERT)
+				cursor->step = where - run->one;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Returns the offset in file one the cursor is at. Inserted bytes are at
+   the offset of the byte of file one they come before. */
+hex_offset edit_offset(struct byte_diff *diff, struct edit_cursor *cursor)
+{
+	struct edit_run *run;
+
+	if (cursor->run >= diff->count)
+		return diff->start_one + diff->length_one;
+	run = &diff->runs[cursor->run];
+	return diff->start_one + run->one
+	       + ((run->type == EDIT_INSERT) ? 0 : cursor->step);
+}
+
+/* Reads the edit at the cursor and moves past it. The bytes it has are
+   given in byte_one and byte_two; the other one is left alone. Returns
+   the kind of edit, or EDIT_END past the end of the diff. */
+int next_edit(struct byte_diff *diff, struct edit_cursor *cursor,
+              unsigned char *byte_one, unsigned char *byte_two)
+{
+	struct edit_run *run;
+
+	if (cursor->run >= diff->count) return EDIT_END;
+	run = &diff->runs[cursor->run];
+	if (run->type != EDIT_INSERT)
+		*byte_one = diff->data_one[run->one + cursor->step];
+	if (run->type != EDIT_DELETE)
+		*byte_two = diff->data_two[run->two + cursor->step];
+	if (++cursor->step == run->length) {
+		cursor->run++;
+		cursor->step = 0;
+	}
+	return run->type;
+}
@@ -0,0 +1,77 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HEX_BYTEDIFF
+#define HEX_BYTEDIFF
+
+#include "general.h"
+#include "fileio.h"
+
+#define EDIT_WINDOW (256UL * 1024) /* Bytes of each file diffed at once */
+#define EDIT_MAX_EDITS 1024L    /* Most bytes inserted and deleted    */
+#define EDIT_BUDGET (32L * 1024 * 1024) /* Most steps taken by a diff */
+
+#define EDIT_END -1             /* Past the end of the windows        */
+#define EDIT_SAME 0             /* Both files have the byte           */
+#define EDIT_CHANGE 1           /* Each file has a byte of its own    */
+#define EDIT_DELETE 2           /* Only file one has the byte         */
+#define EDIT_INSERT 3           /* Only file two has the byte         */
+
+/* A stretch of the edit script, from one on in the window of file one,
+   and from two on in that of file two. Deleted bytes are not in file
+   two's window, and inserted bytes not in file one's: these runs take
+   up no room in that window. */
+struct edit_run {
+	int type;
+	unsigned long one;
+	unsigned long two;
+	unsigned long length;
+};
+
+/* How a window of file one turns into a window of file two, byte by
+   byte. The windows are kept, for the bytes to be shown. If the files
+   differ too much in them to be diffed within the limits above, the diff
+   is left incomplete, without runs. */
+struct byte_diff {
+	hex_offset start_one;        /* Where the windows start           */
+	hex_offset start_two;
+	unsigned char *data_one;     /* The bytes of each window          */
+	unsigned char *data_two;
+	unsigned long length_one;    /* Bytes in each window              */
+	unsigned long length_two;
+	struct edit_run *runs;
+	unsigned long count;
+	int complete;                /* The runs are there                */
+};
+
+/* A place in the edit script: a run, and how far into it. */
+struct edit_cursor {
+	unsigned long run;
+	unsigned long step;
+};
+
+struct byte_diff *diff_window(struct file_view *view_one,
+                              struct file_view *view_two, hex_offset one,
+                              hex_offset two);
+void free_byte_diff(struct byte_diff *diff);
+int diff_covers(struct byte_diff *diff, hex_offset offset);
+int seek_edit(struct byte_diff *diff, hex_offset offset,
+              struct edit_cursor *cursor);
+hex_offset edit_offset(struct byte_diff *diff, struct edit_cursor *cursor);
+int next_edit(struct byte_diff *diff, struct edit_cursor *cursor,
+              unsigned char *byte_one, unsigned char *byte_two);
+
+#endif
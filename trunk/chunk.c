@@ -0,0 +1,572 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "chunk.h"
+#include "fileio.h"
+#include "diffmap.h"
+#include "hash.h"
+#include "job.h"
+#include "gui.h"
+
+#ifdef HEX_POSIX
+#include <pthread.h>
+#endif
+
+/* Files are cut into chunks the way FastCDC does it. A gear hash, which
+   shifts left by a bit and adds a random number for each byte, only
+   depends on the last 32 bytes, and a chunk ends wherever its top bits
+   are all zero. Chunks are kept between a quarter of their usual size and
+   eight times it, and cut with a stricter mask before that size than
+   after it, so that most of them stay close to it. Each file is split in
+   sections that threads cut on their own, reading them in order; a chunk
+   ends at the end of every section, which only costs a chunk that may
+   not match every CHUNK_SECTION bytes. The chunks of both files are then
+   looked up by the hash of their bytes, wherever they are, and the bytes
+   of each pair found that way are compared before it is taken. */
+
+/* The work shared by the threads cutting the files. */
+struct chunker {
+	struct file *files[2];
+	unsigned long sections[2];   /* Sections in each file             */
+	struct chunk_list *found;    /* Chunks of each section, or NULL   */
+	unsigned long next_section;  /* First section not claimed yet     */
+	unsigned long average;       /* Usual size of a chunk             */
+	unsigned long minimum;       /* Smallest chunk, but the last ones */
+	unsigned long maximum;       /* Largest chunk                     */
+	unsigned long mask_small;    /* Mask before the usual size        */
+	unsigned long mask_large;    /* Mask after it                     */
+	struct job *job;             /* Job to report progress to, or NULL */
+	volatile int cancelled;      /* The job asked to give up          */
+#ifdef HEX_POSIX
+	pthread_mutex_t lock;        /* Protects next_section             */
+#endif
+};
+
+/* Random numbers added for each byte. They are the same on every
+   platform, so that files are cut the same way everywhere. */
+static unsigned long gear[256];
+
+/* #####################################################################
+   ##                      CUTTING CHUNKS                             ##
+   ##################################################################### */
+
+static void init_gear(void)
+{
+	unsigned long state = 0x2545f491UL;
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		state ^= (state << 13) & 0xffffffffUL;
+		state ^= state >> 17;
+		state ^= (state << 5) & 0xffffffffUL;
+		gear[i] = state;
+	}
+}
+
+/* Mask of the given number of top bits of a 32-bit hash. */
+static unsigned long top_bits(int bits)
+{
+	return (0xffffffffUL << (32 - bits)) & 0xffffffffUL;
+}
+
+/* Length of the chunk at the start of data, of which length bytes are at
+   hand: at least the largest chunk, or the rest of the section. */
+static unsigned long cut_chunk(struct chunker *chunker,
+                               const unsigned char *data,
+                               unsigned long length)
+{
+	unsigned long hash = 0, i, normal = chunker->average;
+	unsigned long end = chunker->maximum;
+
+	if (length <= chunker->minimum) return length;
+	if (end > length) end = length;
+	if (normal > end) normal = end;
+
+	for (i = chunker->minimum; i < normal; i++) {
+		hash = ((hash << 1) + gear[data[i]]) & 0xffffffffUL;
+		if ((hash & chunker->mask_small) == 0) return i + 1;
+	}
+	for (; i < end; i++) {
+		hash = ((hash << 1) + gear[data[i]]) & 0xffffffffUL;
+		if ((hash & chunker->mask_large) == 0) return i + 1;
+	}
+
+	return end;
+}
+
+/* Cuts a section of a file into chunks, which are left in the list of
+   the section. The list is left without chunks if memory runs out. */
+static void chunk_section(struct chunker *chunker, unsigned long section)
+{
+	int which = (section >= chunker->sections[0]);
+	struct file *file = chunker->files[which];
+	struct chunk_list *list = &chunker->found[section];
+	struct chunk *chunks, *chunk;
+	struct file_view view;
+	struct hash hash;
+	hex_offset offset, end, base;
+	unsigned long capacity, room = 64, filled = 0, kept, length, got;
+	unsigned char *buffer, *data;
+
+	if (which) section -= chunker->sections[0];
+	offset = base = (hex_offset) section * CHUNK_SECTION;
+	end = offset + CHUNK_SECTION;
+	if (end > file->size) end = file->size;
+	capacity = (CHUNK_BUFFER > 2 * chunker->maximum) ? CHUNK_BUFFER
+	           : 2 * chunker->maximum;
+
+	buffer = malloc(capacity);
+	list->chunks = malloc(sizeof(struct chunk) * room);
+	list->count = 0;
+	if (buffer == NULL || list->chunks == NULL) {
+		free(buffer);
+		free(list->chunks);
+		list->chunks = NULL;
+		return;
+	}
+
+	init_view(&view, file, CHUNK_BUFFER, ADVISE_SEQUENTIAL);
+	while (offset < end) {
+		/* Read on once the largest chunk may not be at hand. A
+		   file that cannot be read further ends there. */
+		if (offset + chunker->maximum > base + filled &&
+		    base + filled < end) {
+			kept = (unsigned long) (base + filled - offset);
+			memmove(buffer, buffer + (offset - base), kept);
+			base = offset;
+			length = capacity - kept;
+			if (end - (base + kept) < length)
+				length = (unsigned long) (end - (base + kept));
+			got = copy_view(&view, base + kept, buffer + kept,
+			                length);
+			if (advance_job(chunker->job, got)) {
+				chunker->cancelled = 1;
+				break;
+			}
+			filled = kept + got;
+			if (got == 0) end = base + kept;
+			if (offset == end) break;
+		}
+
+		if (list->count == room) {
+			room *= 2;
+			chunks = realloc(list->chunks,
+			                 sizeof(struct chunk) * room);
+			if (chunks == NULL) {
+				free(list->chunks);
+				list->chunks = NULL;
+				break;
+			}
+			list->chunks = chunks;
+		}
+
+		data = buffer + (offset - base);
+		chunk = &list->chunks[list->count++];
+		chunk->offset = offset;
+		chunk->length = cut_chunk(chunker, data,
+		                          (unsigned long) (base + filled -
+		                                           offset));
+		start_hash(&hash);
+		update_hash(&hash, data, chunk->length);
+		chunk->hash = finish_hash(&hash);
+		offset += chunk->length;
+	}
+
+	free_view(&view);
+	free(buffer);
+}
+
+/* #####################################################################
+   ##                      CHUNKING THREADS                           ##
+   ##################################################################### */
+
+/* Hands out the next section of either file. Returns 0 when there is
+   none left. */
+static int claim_section(struct chunker *chunker, unsigned long *section)
+{
+	unsigned long total = chunker->sections[0] + chunker->sections[1];
+
+#ifdef HEX_POSIX
+	pthread_mutex_lock(&chunker->lock);
+#endif
+	*section = chunker->next_section;
+	if (*section < total) chunker->next_section++;
+#ifdef HEX_POSIX
+	pthread_mutex_unlock(&chunker->lock);
+#endif
+	return (*section < total && !chunker->cancelled);
+}
+
+#ifdef HEX_POSIX
+static void *chunk_worker(void *argument)
+{
+	struct chunker *chunker = argument;
+	unsigned long section;
+
+	while (claim_section(chunker, &section))
+		chunk_section(chunker, section);
+	return NULL;
+}
+#endif
+
+/* Cuts all the sections of both files, over the given number of threads
+   where there are threads. */
+static void chunk_sections(struct chunker *chunker, int threads)
+{
+	unsigned long section;
+#ifdef HEX_POSIX
+	unsigned long total = chunker->sections[0] + chunker->sections[1];
+	pthread_t *workers;
+	int started = 0;
+
+	/* This thread is one of them. */
+	if ((unsigned long) threads > total) threads = (int) total;
+	pthread_mutex_init(&chunker->lock, NULL);
+	workers = malloc(sizeof(pthread_t) * (threads + 1));
+	if (workers != NULL) {
+		for (; started < threads - 1; started++) {
+			if (pthread_create(&workers[started], NULL,
+			                   chunk_worker, chunker) != 0) break;
+		}
+	}
+#else
+	(void) threads;
+#endif
+
+	while (claim_section(chunker, &section))
+		chunk_section(chunker, section);
+
+#ifdef HEX_POSIX
+	while (started > 0) pthread_join(workers[--started], NULL);
+	free(workers);
+	pthread_mutex_destroy(&chunker->lock);
+#endif
+}
+
+/* Puts the chunks of the sections of a file together. Returns 1 if
+   there is not enough memory, or if a section ran out of it. */
+static int join_sections(struct chunk_list *list,
+                         struct chunk_list *sections, unsigned long count)
+{
+	unsigned long i, total = 0;
+
+	for (i = 0; i < count; i++) {
+		if (sections[i].chunks == NULL) return 1;
+		total += sections[i].count;
+	}
+
+	list->chunks = malloc(sizeof(struct chunk) * (total + 1));
+	if (list->chunks == NULL) return 1;
+	for (i = 0; i < count; i++) {
+		memcpy(list->chunks + list->count, sections[i].chunks,
+		       sizeof(struct chunk) * sections[i].count);
+		list->count += sections[i].count;
+	}
+
+	return 0;
+}
+
+/* #####################################################################
+   ##                      PAIRING CHUNKS                             ##
+   ##################################################################### */
+
+/* Tells whether two chunks may hold the same bytes, going by their
+   hashes alone. */
+static int same_bytes(struct chunk *a, struct chunk *b)
+{
+	return (a->hash == b->hash && a->length == b->length);
+}
+
+/* Tells whether a chunk read through one view holds the same bytes as a
+   chunk of the same length read through another. Hashes as wide as an
+   unsigned long do collide, and a pair taken on its hash alone would
+   show unrelated bytes as moved. */
+static int confirm_bytes(struct file_view *view, struct chunk *chunk,
+                         struct file_view *other_view, struct chunk *other)
+{
+	const unsigned char *data, *other_data;
+	unsigned long done = 0, available, other_available;
+
+	while (done < chunk->length) {
+		data = read_view(view, chunk->offset + done,
+		                 chunk->length - done, &available);
+		other_data = read_view(other_view, other->offset + done,
+		                       chunk->length - done, &other_available);
+		if (available == 0 || other_available == 0) return 0;
+		if (available > other_available) available = other_available;
+		if (memcmp(data, other_data, available) != 0) return 0;
+		done += available;
+	}
+
+	return 1;
+}
+
+static unsigned long chunk_bucket(struct chunk *chunk, unsigned long mask)
+{
+	unsigned long value = chunk->hash ^ (chunk->hash >> 16) ^
+	                      chunk->length;
+
+	return (value * 2654435761UL) & mask;
+}
+
+/* Index of the chunk of a list that holds offset, or count if there is
+   none. */
+static unsigned long find_chunk(struct chunk_list *list, hex_offset offset)
+{
+	unsigned long low = 0, high = list->count;
+
+	while (low < high) {
+		unsigned long middle = low + (high - low) / 2;
+		if (list->chunks[middle].offset > offset) high = middle;
+		else low = middle + 1;
+	}
+
+	if (low == 0 || offset >= list->chunks[low - 1].offset +
+	                          list->chunks[low - 1].length)
+		return list->count;
+	return low - 1;
+}
+
+/* Pairs every chunk of list with a chunk of other that holds the same
+   bytes: the one at the same offset if it does, or else the first one in
+   other. The files of list and other are read through the given views.
+   Returns 1 if there is not enough memory. */
+static int match_chunks(struct chunk_list *list, struct chunk_list *other,
+                        struct file_view *view,
+                        struct file_view *other_view)
+{
+	unsigned long buckets, mask, i, j, head, *heads, *next;
+	struct chunk *chunk;
+
+	for (buckets = 1; buckets < other->count; buckets *= 2);
+	mask = buckets - 1;
+	heads = malloc(sizeof(unsigned long) * buckets);
+	next = malloc(sizeof(unsigned long) * (other->count + 1));
+	list->partners = malloc(sizeof(unsigned long) * (list->count + 1));
+	if (heads == NULL || next == NULL || list->partners == NULL) {
+		free(heads);
+		free(next);
+		return 1;
+	}
+	memset(heads, 0xff, sizeof(unsigned long) * buckets);
+
+	/* Chunks go into the table from the last one, each ahead of the
+	   ones after it. A chunk replaces the one it would go ahead of if
+	   they seem to hold the same bytes, so that runs of equal chunks
+	   take up a single place in their bucket. Should their hashes only
+	   collide, the chunk replaced merely goes without a partner. */
+	for (j = other->count; j-- > 0; ) {
+		chunk = &other->chunks[j];
+		head = heads[chunk_bucket(chunk, mask)];
+		if (head != NO_CHUNK && same_bytes(chunk, &other->chunks[head]))
+			head = next[head];
+		next[j] = head;
+		heads[chunk_bucket(chunk, mask)] = j;
+	}
+
+	for (i = 0; i < list->count; i++) {
+		chunk = &list->chunks[i];
+		list->partners[i] = NO_CHUNK;
+		j = find_chunk(other, chunk->offset);
+		if (j < other->count && other->chunks[j].offset ==
+		    chunk->offset && same_bytes(chunk, &other->chunks[j]) &&
+		    confirm_bytes(view, chunk, other_view,
+		                  &other->chunks[j])) {
+			list->partners[i] = j;
+			continue;
+		}
+		for (j = heads[chunk_bucket(chunk, mask)]; j != NO_CHUNK;
+		     j = next[j]) {
+			if (same_bytes(chunk, &other->chunks[j]) &&
+			    confirm_bytes(view, chunk, other_view,
+			                  &other->chunks[j])) {
+				list->partners[i] = j;
+				break;
+			}
+		}
+	}
+
+	free(heads);
+	free(next);
+	return 0;
+}
+
+/* #####################################################################
+   ##                     BUILDING CHUNK MAPS                         ##
+   ##################################################################### */
+
+/* Cuts both files into chunks, and pairs up those that hold the same
+   bytes. The work is spread over the given number of threads, and its
+   progress reported to job unless it is NULL. Returns NULL if there is
+   not enough memory for it, or if the job asked it to give up. */
+struct chunk_map *chunk_files(struct file *file_one, struct file *file_two,
+                              int threads, struct job *job)
+{
+	struct chunker chunker;
+	struct file_view views[2];
+	struct chunk_map *map = malloc(sizeof(struct chunk_map));
+	hex_offset largest;
+	unsigned long total, i;
+	int bits, failed;
+
+	if (map == NULL) return NULL;
+	for (i = 0; i < 2; i++) {
+		map->files[i].chunks = NULL;
+		map->files[i].count = 0;
+		map->files[i].partners = NULL;
+	}
+
+	/* Chunks get larger with the files, so that there are only so many
+	   of them. */
+	chunker.files[0] = file_one;
+	chunker.files[1] = file_two;
+	largest = (file_one->size > file_two->size) ? file_one->size
+	          : file_two->size;
+	chunker.average = CHUNK_AVERAGE;
+	while (largest / chunker.average > CHUNK_MAX_COUNT)
+		chunker.average *= 2;
+	for (bits = 0; (1UL << bits) < chunker.average; bits++);
+	chunker.minimum = chunker.average / 4;
+	chunker.maximum = chunker.average * 8;
+	chunker.mask_small = top_bits(bits + 2);
+	chunker.mask_large = top_bits(bits - 2);
+	init_gear();
+
+	for (i = 0; i < 2; i++)
+		chunker.sections[i] = (unsigned long)
+		                      ((chunker.files[i]->size + CHUNK_SECTION -
+		                        1) / CHUNK_SECTION);
+	total = chunker.sections[0] + chunker.sections[1];
+	chunker.next_section = 0;
+	chunker.job = job;
+	chunker.cancelled = 0;
+	chunker.found = malloc(sizeof(struct chunk_list) * (total + 1));
+	if (chunker.found == NULL) {
+		free(map);
+		return NULL;
+	}
+	for (i = 0; i < total; i++) chunker.found[i].chunks = NULL;
+
+	advise_file(file_one, 0, file_one->size, ADVISE_SEQUENTIAL);
+	advise_file(file_two, 0, file_two->size, ADVISE_SEQUENTIAL);
+	chunk_sections(&chunker, threads);
+
+	/* The files will now be read at random, to compare the bytes of
+	   the chunks paired up, and later on by the display. */
+	advise_file(file_one, 0, file_one->size, ADVISE_RANDOM);
+	advise_file(file_two, 0, file_two->size, ADVISE_RANDOM);
+	init_view(&views[0], file_one, CHUNK_BUFFER, ADVISE_RANDOM);
+	init_view(&views[1], file_two, CHUNK_BUFFER, ADVISE_RANDOM);
+
+	failed = (chunker.cancelled ||
+	          join_sections(&map->files[0], chunker.found,
+	                        chunker.sections[0]) != 0 ||
+	          join_sections(&map->files[1],
+	                        chunker.found + chunker.sections[0],
+	                        chunker.sections[1]) != 0 ||
+	          match_chunks(&map->files[0], &map->files[1], &views[0],
+	                       &views[1]) != 0 ||
+	          match_chunks(&map->files[1], &map->files[0], &views[1],
+	                       &views[0]) != 0);
+	for (i = 0; i < total; i++) free(chunker.found[i].chunks);
+	free(chunker.found);
+	free_view(&views[0]);
+	free_view(&views[1]);
+
+	if (failed) {
+		free_chunk_map(map);
+		return NULL;
+	}
+	return map;
+}
+
+void free_chunk_map(struct chunk_map *map)
+{
+	int i;
+
+	if (map == NULL) return;
+	for (i = 0; i < 2; i++) {
+		free(map->files[i].chunks);
+		free(map->files[i].partners);
+	}
+	free(map);
+}
+
+/* #####################################################################
+   ##                      USING CHUNK MAPS                           ##
+   ##################################################################### */
+
+/* Tells whether the chunks of a list that hold any of [start, end) all
+   have a partner. *index is moved on to the first chunk that ends after
+   start, so that ranges can be checked in order. */
+static int range_moved(struct chunk_list *list, unsigned long *index,
+                       hex_offset start, hex_offset end)
+{
+	unsigned long i;
+
+	while (*index < list->count && list->chunks[*index].offset +
+	       list->chunks[*index].length <= start) (*index)++;
+	for (i = *index; i < list->count && list->chunks[i].offset < end;
+	     i++)
+		if (list->partners[i] == NO_CHUNK) return 0;
+
+	return 1;
+}
+
+/* Shows the differing blocks of the overview whose bytes both files have
+   somewhere in the other one as moved. */
+void moved_blocks(struct chunk_map *map, char *block_cache,
+                  int total_blocks, hex_offset bytes_per_block,
+                  int blocks_with_excess_byte)
+{
+	unsigned long index_one = 0, index_two = 0;
+	hex_offset start, end;
+	int block;
+
+	for (block = 0; block < total_blocks; block++) {
+		if (block_cache[block] != BLOCK_DIFFERENT &&
+		    (block_cache[block] < BLOCK_HEAT ||
+		     block_cache[block] >= BLOCK_HEAT + HEAT_LEVELS))
+			continue;
+
+		start = block_offset(block, bytes_per_block,
+		                     blocks_with_excess_byte);
+		end = block_offset(block + 1, bytes_per_block,
+		                   blocks_with_excess_byte);
+		if (range_moved(&map->files[0], &index_one, start, end) &&
+		    range_moved(&map->files[1], &index_two, start, end))
+			block_cache[block] = BLOCK_MOVED;
+	}
+}
+
+/* Finds where the byte at offset in one of the files (0 or 1) is in the
+   other one, going by the chunk that holds it, and sets *found to it.
+   Returns 0 if that chunk is not elsewhere in the other file. */
+int counterpart(struct chunk_map *map, int side, hex_offset offset,
+                hex_offset *found)
+{
+	struct chunk_list *list = &map->files[side];
+	unsigned long i = find_chunk(list, offset);
+	struct chunk *partner;
+
+	if (i == list->count || list->partners[i] == NO_CHUNK) return 0;
+	partner = &map->files[!side].chunks[list->partners[i]];
+	if (partner->offset == list->chunks[i].offset) return 0;
+	*found = partner->offset + (offset - list->chunks[i].offset);
+	return 1;
+}
@@ -0,0 +1,61 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HEX_CHUNK
+#define HEX_CHUNK
+
+#include "general.h"
+
+#define CHUNK_AVERAGE 8192UL    /* Usual size of a chunk, at least    */
+#define CHUNK_MAX_COUNT (1UL << 20) /* Chunks a file is cut in, about  */
+#define CHUNK_SECTION (64UL * 1024 * 1024) /* Bytes a thread cuts at once */
+#define CHUNK_BUFFER (1024UL * 1024) /* Bytes a thread reads at once  */
+#define NO_CHUNK (~0UL)
+
+/* A piece of a file, cut where its bytes say so rather than at fixed
+   offsets, so that the same bytes are cut the same way wherever they
+   are. */
+struct chunk {
+	hex_offset offset;
+	unsigned long length;
+	unsigned long hash;          /* Hash of its bytes                 */
+};
+
+/* The chunks of a file, in order. Each one is paired with a chunk of the
+   other file that holds the same bytes, at the same offset if there is
+   one there. */
+struct chunk_list {
+	struct chunk *chunks;
+	unsigned long count;
+	unsigned long *partners;     /* Chunk of the other file, or NO_CHUNK */
+};
+
+struct chunk_map {
+	struct chunk_list files[2];
+};
+
+struct job;
+
+struct chunk_map *chunk_files(struct file *file_one, struct file *file_two,
+                              int threads, struct job *job);
+void free_chunk_map(struct chunk_map *map);
+void moved_blocks(struct chunk_map *map, char *block_cache,
+                  int total_blocks, hex_offset bytes_per_block,
+                  int blocks_with_excess_byte);
+int counterpart(struct chunk_map *map, int side, hex_offset offset,
+                hex_offset *found);
+
+#endif
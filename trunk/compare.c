@@ -0,0 +1,216 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "compare.h"
+
+#ifdef HEX_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/* #####################################################################
+   ##                    PORTABLE COMPARE KERNEL                      ##
+   ##################################################################### */
+
+/* Compares a machine word at a time. Words are loaded with memcpy() so
+   that unaligned buffers are fine; compilers turn it into a plain load. */
+static unsigned long find_mismatch_word(const unsigned char *a,
+                                        const unsigned char *b,
+                                        unsigned long length)
+{
+	unsigned long i = 0;
+
+	while (i + sizeof(unsigned long) <= length) {
+		unsigned long word_a, word_b;
+		memcpy(&word_a, a + i, sizeof(word_a));
+		memcpy(&word_b, b + i, sizeof(word_b));
+		if (word_a != word_b) break;
+		i += sizeof(unsigned long);
+	}
+
+	/* Locate the byte within the word that differs, and finish off
+	   the tail. */
+	for (; i < length; i++) {
+		if (a[i] != b[i]) return i;
+	}
+
+	return length;
+}
+
+/* #####################################################################
+   ##                      x86 VECTOR KERNELS                         ##
+   ##################################################################### */
+
+#ifdef HEX_X86_KERNELS
+
+__attribute__((target("sse2")))
+static unsigned long find_mismatch_sse2(const unsigned char *a,
+                                        const unsigned char *b,
+                                        unsigned long length)
+{
+	unsigned long i = 0;
+
+	for (; i + 16 <= length; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *) (a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *) (b + i));
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+		if (mask != 0xFFFF) return i + __builtin_ctz(~mask);
+	}
+
+	return i + find_mismatch_word(a + i, b + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static unsigned long find_mismatch_avx2(const unsigned char *a,
+                                        const unsigned char *b,
+                                        unsigned long length)
+{
+	unsigned long i = 0;
+
+	/* Two vectors per iteration keep both load ports busy. */
+	for (; i + 64 <= length; i += 64) {
+		const __m256i *p = (const __m256i *) (a + i);
+		const __m256i *q = (const __m256i *) (b + i);
+		__m256i equal_0, equal_1, equal;
+
+		equal_0 = _mm256_cmpeq_epi8(_mm256_loadu_si256(p),
+		                            _mm256_loadu_si256(q));
+		equal_1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(p + 1),
+		                            _mm256_loadu_si256(q + 1));
+		equal = _mm256_and_si256(equal_0, equal_1);
+		if ((unsigned int) _mm256_movemask_epi8(equal) != 0xFFFFFFFFU)
+			break;
+	}
+
+	for (; i + 32 <= length; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+		unsigned int mask;
+		mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if (mask != 0xFFFFFFFFU) return i + __builtin_ctz(~mask);
+	}
+
+	return i + find_mismatch_word(a + i, b + i, length - i);
+}
+
+#if defined(__x86_64__) && (__GNUC__ >= 5 || defined(__clang__))
+#define HEX_AVX512_KERNEL
+
+__attribute__((target("avx512f,avx512bw")))
+static unsigned long find_mismatch_avx512(const unsigned char *a,
+                                          const unsigned char *b,
+                                          unsigned long length)
+{
+	unsigned long i = 0;
+	__mmask64 mask;
+
+	for (; i + 64 <= length; i += 64) {
+		__m512i x = _mm512_loadu_si512((const void *) (a + i));
+		__m512i y = _mm512_loadu_si512((const void *) (b + i));
+		mask = _mm512_cmpneq_epi8_mask(x, y);
+		if (mask != 0) return i + __builtin_ctzll(mask);
+	}
+
+	/* The tail is handled with a masked load, which cannot fault on
+	   the bytes past the end. */
+	if (i < length) {
+		__mmask64 tail = ((__mmask64) 1 << (length - i)) - 1;
+		__m512i x = _mm512_maskz_loadu_epi8(tail, a + i);
+		__m512i y = _mm512_maskz_loadu_epi8(tail, b + i);
+		mask = _mm512_mask_cmpneq_epi8_mask(tail, x, y);
+		if (mask != 0) return i + __builtin_ctzll(mask);
+	}
+
+	return length;
+}
+#endif
+
+#endif
+
+/* #####################################################################
+   ##                      KERNEL SELECTION                           ##
+   ##################################################################### */
+
+compare_kernel find_mismatch = find_mismatch_word;
+static const char *kernel_name = "word";
+
+/* Picks the fastest kernel the processor supports. Called once at
+   startup, before any comparison is made. */
+void init_compare(void)
+{
+#ifdef HEX_X86_KERNELS
+	__builtin_cpu_init();
+#ifdef HEX_AVX512_KERNEL
+	if (__builtin_cpu_supports("avx512bw")) {
+		find_mismatch = find_mismatch_avx512;
+		kernel_name = "avx512";
+		return;
+	}
+#endif
+	if (__builtin_cpu_supports("avx2")) {
+		find_mismatch = find_mismatch_avx2;
+		kernel_name = "avx2";
+		return;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		find_mismatch = find_mismatch_sse2;
+		kernel_name = "sse2";
+		return;
+	}
+#endif
+}
+
+const char *compare_kernel_name(void)
+{
+	return kernel_name;
+}
+
+/* #####################################################################
+   ##                     RUNS OF DIFFERENCES                         ##
+   ##################################################################### */
+
+/* Given ranges that start with a differing byte, returns the length of
+   the run of differences they start with, up to its last differing byte.
+   Fewer than SPAN_GAP equal bytes in a row do not end the run. Any such
+   stretch holds a whole word, so the differing part is skipped a word at
+   a time, and the equal words are measured with find_mismatch(). */
+unsigned long span_difference(const unsigned char *a, const unsigned char *b,
+                              unsigned long length)
+{
+	unsigned long position = 0, last, equal;
+
+	for (;;) {
+		/* Skip the words that differ somewhere. */
+		while (position + sizeof(unsigned long) <= length) {
+			unsigned long word_a, word_b;
+			memcpy(&word_a, a + position, sizeof(word_a));
+			memcpy(&word_b, b + position, sizeof(word_b));
+			if (word_a == word_b) break;
+			position += sizeof(unsigned long);
+		}
+		if (position + sizeof(unsigned long) > length)
+			position = length;
+
+		/* Step back to the last byte that differs. */
+		for (last = position; a[last - 1] == b[last - 1]; last--);
+		if (position == length) return last;
+
+		/* The run goes on if the equal bytes are too few. */
+		equal = position + find_mismatch(a + position, b + position,
+		                                 length - position);
+		if (equal == length || equal - last >= SPAN_GAP) return last;
+		position = equal;
+	}
+}
@@ -0,0 +1,43 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEX_COMPARE
+#define HEX_COMPARE
+
+/* The vectorized kernels are only built with GCC-compatible compilers
+   targeting x86, where they can be selected at runtime. Everything else
+   uses the portable word-at-a-time kernel. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    !defined(__DJGPP__)
+#define HEX_X86_KERNELS
+#endif
+
+/* Returns the index of the first byte that differs between a and b, or
+   length if the two ranges are identical. */
+typedef unsigned long (*compare_kernel)(const unsigned char *a,
+                                        const unsigned char *b,
+                                        unsigned long length);
+
+/* Equal bytes it takes to separate two runs of differing bytes. */
+#define SPAN_GAP (2 * sizeof(unsigned long))
+
+extern compare_kernel find_mismatch;
+
+void init_compare(void);
+const char *compare_kernel_name(void);
+unsigned long span_difference(const unsigned char *a, const unsigned char *b,
+                              unsigned long length);
+
+#endif
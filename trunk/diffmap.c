@@ -0,0 +1,630 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include "diffmap.h"
+#include "compare.h"
+#include "index.h"
+#include "gui.h"
+
+/* #####################################################################
+   ##                       BIT HELPERS                               ##
+   ##################################################################### */
+
+static int count_bits(unsigned long word)
+{
+#ifdef __GNUC__
+	return __builtin_popcountl(word);
+#else
+	int count = 0;
+	for (; word != 0; word &= word - 1) count++;
+	return count;
+#endif
+}
+
+/* Makes the writes done so far visible to other threads before the ones
+   that follow. */
+static void memory_barrier(void)
+{
+#ifdef __GNUC__
+	__sync_synchronize();
+#endif
+}
+
+/* Number of differing chunks before chunk. Only valid once the map is
+   complete. */
+static unsigned long rank(struct diff_map *map, unsigned long chunk)
+{
+	unsigned long word = chunk / WORD_BITS;
+	unsigned long bit = chunk % WORD_BITS;
+
+	if (bit == 0) return map->ranks[word];
+	return map->ranks[word] + count_bits(map->bits[word] &
+	                                     ((1UL << bit) - 1));
+}
+
+/* Number of differing chunks in [first, last). Chunks that were not
+   scanned yet do not count. */
+static unsigned long count_differing(struct diff_map *map,
+                                     unsigned long first, unsigned long last)
+{
+	unsigned long word, count = 0;
+
+	if (first >= last) return 0;
+	if (map->ranks != NULL) return rank(map, last) - rank(map, first);
+
+	/* The map is still being filled in: count word by word. */
+	for (word = first / WORD_BITS; word <= (last - 1) / WORD_BITS;
+	     word++) {
+		unsigned long mask = ~0UL;
+		if (word == first / WORD_BITS)
+			mask &= ~0UL << (first % WORD_BITS);
+		if (word == (last - 1) / WORD_BITS && last % WORD_BITS != 0)
+			mask &= ~(~0UL << (last % WORD_BITS));
+		count += count_bits(map->bits[word] & mask);
+	}
+
+	return count;
+}
+
+int chunk_differs(struct diff_map *map, unsigned long chunk)
+{
+	return (map->bits[chunk / WORD_BITS] >> (chunk % WORD_BITS)) & 1;
+}
+
+/* Sets the bits of the chunks in [first, last). */
+static void mark_chunks(struct diff_map *map, unsigned long first,
+                        unsigned long last)
+{
+	for (; first < last; first++)
+		map->bits[first / WORD_BITS] |= 1UL << (first % WORD_BITS);
+}
+
+/* #####################################################################
+   ##                    RANGES OF DIFFERENCES                        ##
+   ##################################################################### */
+
+/* Extends a range to the end of the run of differing bytes [start, end)
+   that follows it, if they are too close together to tell apart. Returns
+   1 if it did, 0 if the run starts a range of its own. The ranges of the
+   display and those of a report are both built by it, so that they are
+   the same. */
+int join_range(struct diff_range *range, hex_offset start, hex_offset end)
+{
+	if (start - range->end >= SPAN_GAP) return 0;
+	range->end = end;
+	return 1;
+}
+
+/* Appends a range to a list, or extends its last range if they are too
+   close together to tell apart. */
+static void append_range(struct diff_range *ranges, unsigned long *count,
+                         hex_offset start, hex_offset end)
+{
+	if (*count > 0 && join_range(&ranges[*count - 1], start, end))
+		return;
+	ranges[*count].start = start;
+	ranges[*count].end = end;
+	(*count)++;
+}
+
+/* Releases the ranges of a list. */
+static void free_ranges(struct range_list *list)
+{
+	if (list->ranges != &list->single) free(list->ranges);
+	list->ranges = NULL;
+	list->count = list->capacity = 0;
+}
+
+/* Makes room for one more range in a list, starting it with room for
+   DIFF_FIRST_RANGES and doubling that as often as needed. Returns 0 when
+   memory runs out; a list always has room for one range, though. */
+static int grow_ranges(struct range_list *list)
+{
+	struct diff_range *grown;
+
+	if (list->ranges == NULL) {
+		list->ranges = malloc(sizeof(struct diff_range) *
+		                      DIFF_FIRST_RANGES);
+		list->capacity = DIFF_FIRST_RANGES;
+		if (list->ranges == NULL) {
+			list->ranges = &list->single;
+			list->capacity = 1;
+		}
+		return 1;
+	}
+	if (list->ranges == &list->single) return 0;
+
+	grown = realloc(list->ranges, sizeof(struct diff_range) *
+	                list->capacity * 2);
+	if (grown == NULL) return 0;
+	list->ranges = grown;
+	list->capacity *= 2;
+	return 1;
+}
+
+/* Adds the run of differing bytes [start, end) to the ranges of a batch,
+   which keeps every range however many there are. Only if memory runs
+   out is the run merged into the last range: that range then covers
+   equal bytes too, but none of the differences is lost. */
+static void add_to_list(struct range_list *list, hex_offset start,
+                        hex_offset end)
+{
+	if (list->count > 0 &&
+	    join_range(&list->ranges[list->count - 1], start, end))
+		return;
+	if (list->count == list->capacity && !grow_ranges(list)) {
+		list->ranges[list->count - 1].end = end;
+		return;
+	}
+	append_range(list->ranges, &list->count, start, end);
+}
+
+/* Adds the bytes of [start, end) to the weights of the words of bits
+   they lie under. */
+static void add_weight(struct diff_map *map, hex_offset start,
+                       hex_offset end)
+{
+	hex_offset span = (hex_offset) DIFF_CHUNK_SIZE * WORD_BITS, edge;
+	unsigned long word;
+
+	while (start < end) {
+		word = (unsigned long) (start / span);
+		edge = (hex_offset) (word + 1) * span;
+		if (edge > end) edge = end;
+		map->weights[word] += (unsigned long) (edge - start);
+		start = edge;
+	}
+}
+
+/* Records the run of differing bytes [start, end), found in a batch: the
+   chunks it covers are marked and weighed, and it joins the ranges of the
+   batch. Only the scan worker that owns the batch may do so, and it must
+   do so in order. */
+void mark_difference(struct diff_map *map, unsigned long batch,
+                     hex_offset start, hex_offset end)
+{
+	struct range_list *list = &map->batch_ranges[batch];
+
+	/* The few equal bytes between the run and the last one belong to
+	   the same run, however the batch was cut when it was read. */
+	if (list->count > 0) {
+		hex_offset last = list->ranges[list->count - 1].end;
+		if (start - last < SPAN_GAP) start = last;
+	}
+	mark_chunks(map, (unsigned long) (start / DIFF_CHUNK_SIZE),
+	            (unsigned long) ((end - 1) / DIFF_CHUNK_SIZE + 1));
+	add_weight(map, start, end);
+	add_to_list(&map->batch_ranges[batch], start, end);
+}
+
+/* Index of the first of the ranges that starts after offset, or count if
+   there is none. */
+static unsigned long find_range(struct diff_range *ranges,
+                                unsigned long count, hex_offset offset)
+{
+	unsigned long low = 0, high = count;
+
+	while (low < high) {
+		unsigned long middle = low + (high - low) / 2;
+		if (ranges[middle].start > offset) high = middle;
+		else low = middle + 1;
+	}
+
+	return low;
+}
+
+/* Tells whether the ranges of a batch can be read yet. */
+static int batch_scanned(struct diff_map *map, unsigned long batch)
+{
+	if (!map->batch_done[batch]) return 0;
+	memory_barrier();
+	return 1;
+}
+
+/* Finds the first range of differences that starts after offset, and
+   sets *found to its start. Returns 0 if there is none. While the map is
+   still being filled in, the batches not scanned yet are skipped. */
+int next_difference(struct diff_map *map, hex_offset offset,
+                    hex_offset *found)
+{
+	struct range_list *list;
+	unsigned long batch, i;
+
+	if (map->complete) {
+		i = find_range(map->ranges, map->range_count, offset);
+		if (i == map->range_count) return 0;
+		*found = map->ranges[i].start;
+		return 1;
+	}
+
+	for (batch = (unsigned long) (offset / DIFF_BATCH_SIZE);
+	     batch < map->batch_count; batch++) {
+		if (!batch_scanned(map, batch)) continue;
+		list = &map->batch_ranges[batch];
+		i = find_range(list->ranges, list->count, offset);
+		if (i < list->count) {
+			*found = list->ranges[i].start;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Finds the last range of differences that starts before offset, and
+   sets *found to its start. Returns 0 if there is none. */
+int previous_difference(struct diff_map *map, hex_offset offset,
+                        hex_offset *found)
+{
+	struct range_list *list;
+	unsigned long batch, i;
+
+	if (offset == 0) return 0;
+
+	if (map->complete) {
+		i = find_range(map->ranges, map->range_count, offset - 1);
+		if (i == 0) return 0;
+		*found = map->ranges[i - 1].start;
+		return 1;
+	}
+
+	if (offset / DIFF_BATCH_SIZE >= map->batch_count)
+		batch = map->batch_count - 1;
+	else batch = (unsigned long) (offset / DIFF_BATCH_SIZE);
+	for (batch++; batch-- > 0; ) {
+		if (!batch_scanned(map, batch)) continue;
+		list = &map->batch_ranges[batch];
+		i = find_range(list->ranges, list->count, offset - 1);
+		if (i > 0) {
+			*found = list->ranges[i - 1].start;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* #####################################################################
+   ##                 BUILDING THE DIFFERENCE MAP                     ##
+   ##################################################################### */
+
+/* Works out the layout of the map of files of the given size, without
+   allocating anything. */
+void init_diff_map(struct diff_map *map, hex_offset size)
+{
+	map->size = size;
+	map->chunk_count = (unsigned long) ((size + DIFF_CHUNK_SIZE - 1) /
+	                                    DIFF_CHUNK_SIZE);
+	map->batch_count = (map->chunk_count + DIFF_BATCH_CHUNKS - 1) /
+	                   DIFF_BATCH_CHUNKS;
+	map->word_count = map->chunk_count / WORD_BITS + 1;
+	map->bits = NULL;
+	map->ranks = NULL;
+	map->weights = NULL;
+	map->prints_one = NULL;
+	map->prints_two = NULL;
+	map->batch_ranges = NULL;
+	map->ranges = NULL;
+	map->range_count = 0;
+	map->batch_done = NULL;
+	map->complete = 0;
+	map->index = NULL;
+	map->index_size = 0;
+}
+
+struct diff_map *new_diff_map(hex_offset size)
+{
+	struct diff_map *map = malloc(sizeof(struct diff_map));
+
+	init_diff_map(map, size);
+	map->bits = calloc(map->word_count, sizeof(unsigned long));
+	map->weights = calloc(map->word_count, sizeof(unsigned long));
+	map->prints_one = calloc(map->chunk_count + 1, sizeof(hex_offset));
+	map->prints_two = calloc(map->chunk_count + 1, sizeof(hex_offset));
+	map->batch_ranges = calloc(map->batch_count + 1,
+	                           sizeof(struct range_list));
+	map->batch_done = calloc(map->batch_count + 1, 1);
+
+	if (map->batch_count == 0) finish_diff_map(map);
+	return map;
+}
+
+void free_diff_map(struct diff_map *map)
+{
+	unsigned long batch;
+
+	if (map == NULL) return;
+	if (map->batch_ranges != NULL) {
+		for (batch = 0; batch < map->batch_count; batch++)
+			free_ranges(&map->batch_ranges[batch]);
+		free(map->batch_ranges);
+	}
+
+	/* A map loaded from an index lives in its mapping. */
+	if (map->index != NULL) {
+		unmap_index(map);
+	} else {
+		free(map->bits);
+		free(map->ranks);
+		free(map->weights);
+		free(map->prints_one);
+		free(map->prints_two);
+		free(map->ranges);
+	}
+	free((char *) map->batch_done);
+	free(map);
+}
+
+/* Called by the scan once the bits of a batch are all written. */
+void mark_batch_done(struct diff_map *map, unsigned long batch)
+{
+	memory_barrier();
+	map->batch_done[batch] = 1;
+}
+
+/* Takes what a previous map of the same files found in a batch, when
+   neither file changed there since: its bits, weights and ranges are
+   copied over as they are. Ranges that went on into the batches around
+   it are cut at its edges, and joined again once the map is finished.
+   Only the scan worker that owns the batch may do so. */
+void copy_batch(struct diff_map *map, struct diff_map *previous,
+                unsigned long batch)
+{
+	struct range_list *list = &map->batch_ranges[batch];
+	hex_offset start = batch * DIFF_BATCH_SIZE;
+	hex_offset end = start + DIFF_BATCH_SIZE;
+	unsigned long word = batch * (DIFF_BATCH_CHUNKS / WORD_BITS);
+	unsigned long last = word + DIFF_BATCH_CHUNKS / WORD_BITS, i;
+
+	if (last > map->word_count) last = map->word_count;
+	if (last > previous->word_count) last = previous->word_count;
+	for (; word < last; word++) {
+		map->bits[word] = previous->bits[word];
+		map->weights[word] = previous->weights[word];
+	}
+
+	i = find_range(previous->ranges, previous->range_count, start);
+	if (i > 0 && previous->ranges[i - 1].end > start) i--;
+	for (; i < previous->range_count && previous->ranges[i].start < end;
+	     i++) {
+		struct diff_range range = previous->ranges[i];
+
+		if (range.start < start) range.start = start;
+		if (range.end > end) range.end = end;
+		add_to_list(list, range.start, range.end);
+	}
+}
+
+/* Called once every batch is scanned. Counts the differing chunks ahead
+   of every word, so that any range can then be queried in O(1), and
+   gathers the ranges of all batches in a single list, to be searched in
+   O(log n). */
+void finish_diff_map(struct diff_map *map)
+{
+	unsigned long word, batch, i, count = 0;
+	struct range_list *list;
+
+	map->ranks = malloc(sizeof(unsigned long) * (map->word_count + 1));
+	map->ranks[0] = 0;
+	for (word = 0; word < map->word_count; word++)
+		map->ranks[word + 1] = map->ranks[word] +
+		                       count_bits(map->bits[word]);
+
+	/* Ranges that meet at the edge of a batch are joined. */
+	for (batch = 0; batch < map->batch_count; batch++)
+		count += map->batch_ranges[batch].count;
+	map->ranges = malloc(sizeof(struct diff_range) * (count + 1));
+	map->range_count = 0;
+	for (batch = 0; batch < map->batch_count; batch++) {
+		list = &map->batch_ranges[batch];
+		for (i = 0; i < list->count; i++)
+			append_range(map->ranges, &map->range_count,
+			             list->ranges[i].start,
+			             list->ranges[i].end);
+		free_ranges(list);
+	}
+	free(map->batch_ranges);
+	map->batch_ranges = NULL;
+	map->complete = 1;
+}
+
+/* #####################################################################
+   ##                   DERIVING OVERVIEW BLOCKS                      ##
+   ##################################################################### */
+
+/* Offset at which a block of the overview starts. The first
+   blocks_with_excess_byte blocks hold one byte more than the others. */
+hex_offset block_offset(int block, hex_offset bytes_per_block,
+                        int blocks_with_excess_byte)
+{
+	unsigned long excess = (block < blocks_with_excess_byte) ? block
+	                       : blocks_with_excess_byte;
+	return bytes_per_block * block + excess;
+}
+
+/* Block of the overview an offset falls in: the inverse of
+   block_offset(). Offsets past the last byte fall in the first block
+   that starts there, or in the last block. */
+int offset_block(hex_offset offset, int total_blocks,
+                 hex_offset bytes_per_block, int blocks_with_excess_byte)
+{
+	hex_offset boundary = (bytes_per_block + 1) * blocks_with_excess_byte;
+	hex_offset block;
+
+	if (offset < boundary) {
+		block = offset / (bytes_per_block + 1);
+	} else if (bytes_per_block == 0) {
+		block = blocks_with_excess_byte;
+	} else {
+		block = blocks_with_excess_byte +
+		        (offset - boundary) / bytes_per_block;
+	}
+
+	if (block >= (hex_offset) total_blocks) block = total_blocks - 1;
+	return (int) block;
+}
+
+/* Compares the bytes of both files in [start, end), and returns
+   BLOCK_SAME, BLOCK_DIFFERENT or BLOCK_EMPTY. A byte that only one of the
+   files has counts as a difference. */
+char compare_range(struct file_view *view_one, struct file_view *view_two,
+                   hex_offset start, hex_offset end)
+{
+	hex_offset offset;
+
+	/* Neither file has data here. */
+	if (end == start || (start >= view_one->file->size &&
+	    start >= view_two->file->size))
+		return BLOCK_EMPTY;
+
+	/* Walk through the range as far as both views reach at a time. */
+	for (offset = start; offset < end; ) {
+		const unsigned char *data_one, *data_two;
+		unsigned long available_one, available_two, length;
+
+		data_one = read_view(view_one, offset, end - offset,
+		                     &available_one);
+		data_two = read_view(view_two, offset, end - offset,
+		                     &available_two);
+		length = (available_one < available_two) ? available_one
+		         : available_two;
+
+		/* If only one of the files ends here, the ranges are
+		   different. If both do, we're done. */
+		if (length == 0) {
+			if (available_one != available_two)
+				return BLOCK_DIFFERENT;
+			break;
+		}
+
+		/* Compare what both views have in common. */
+		if (find_mismatch(data_one, data_two, length) != length)
+			return BLOCK_DIFFERENT;
+		offset += length;
+	}
+
+	return BLOCK_SAME;
+}
+
+/* Shade of a block where weight bytes of area differ, from BLOCK_HEAT for
+   a few bytes up to BLOCK_HEAT + HEAT_LEVELS - 1 for most of them. */
+char heat_level(hex_offset weight, hex_offset area)
+{
+	if (weight * 256 < area) return BLOCK_HEAT;
+	if (weight * 16 < area) return BLOCK_HEAT + 1;
+	if (weight * 2 < area) return BLOCK_HEAT + 2;
+	return BLOCK_HEAT + 3;
+}
+
+/* Shade of a differing block, from how much of the area the map weighs
+   under it lies in runs of differences. Weights are kept per word of
+   bits, so blocks smaller than that share the shade of the word they lie
+   in. */
+static char block_heat(struct diff_map *map, hex_offset start,
+                       hex_offset end)
+{
+	hex_offset span = (hex_offset) DIFF_CHUNK_SIZE * WORD_BITS;
+	unsigned long first = (unsigned long) (start / span);
+	unsigned long last = (unsigned long) ((end - 1) / span);
+	hex_offset weight = 0, area;
+	unsigned long word;
+
+	for (word = first; word <= last; word++)
+		weight += map->weights[word];
+	area = (hex_offset) (last + 1) * span;
+	if (area > map->size) area = map->size;
+	area -= (hex_offset) first * span;
+
+	return heat_level(weight, area);
+}
+
+/* Works out the status of a block from the map: BLOCK_SAME, one of the
+   shades of BLOCK_HEAT, BLOCK_EMPTY or BLOCK_PENDING. A block stays
+   pending until the scan went through all of it, as its shade can't be
+   told before. A chunk that lies across the edge of the block may differ
+   outside of it only, so those chunks are compared again over the part
+   the block covers. */
+static char derive_block(struct diff_map *map, hex_offset start,
+                         hex_offset end, struct file_view *view_one,
+                         struct file_view *view_two)
+{
+	unsigned long head, tail, batch;
+	hex_offset edge;
+
+	if (end == start) return BLOCK_EMPTY;
+	head = (unsigned long) (start / DIFF_CHUNK_SIZE);
+	tail = (unsigned long) ((end - 1) / DIFF_CHUNK_SIZE);
+
+	/* See whether the scan went through the whole block. The bits of a
+	   batch are visible once it is marked as done. */
+	if (!map->complete) {
+		for (batch = head / DIFF_BATCH_CHUNKS;
+		     batch <= tail / DIFF_BATCH_CHUNKS; batch++) {
+			if (!map->batch_done[batch]) return BLOCK_PENDING;
+		}
+		memory_barrier();
+	}
+
+	/* Chunks lying entirely within the block. */
+	if (count_differing(map, (unsigned long) ((start + DIFF_CHUNK_SIZE -
+	                    1) / DIFF_CHUNK_SIZE), (unsigned long) (end /
+	                    DIFF_CHUNK_SIZE)) > 0)
+		return block_heat(map, start, end);
+
+	/* The chunk lying across the start of the block. */
+	if (start % DIFF_CHUNK_SIZE != 0 && chunk_differs(map, head)) {
+		edge = (hex_offset) (head + 1) * DIFF_CHUNK_SIZE;
+		if (compare_range(view_one, view_two, start,
+		                  (edge < end) ? edge : end) == BLOCK_DIFFERENT)
+			return block_heat(map, start, end);
+	}
+
+	/* The chunk lying across its end, unless that was the same one. */
+	if (end % DIFF_CHUNK_SIZE != 0 && chunk_differs(map, tail) &&
+	    (tail != head || start % DIFF_CHUNK_SIZE == 0)) {
+		edge = (hex_offset) tail * DIFF_CHUNK_SIZE;
+		if (compare_range(view_one, view_two, (edge > start) ? edge
+		                  : start, end) == BLOCK_DIFFERENT)
+			return block_heat(map, start, end);
+	}
+
+	return BLOCK_SAME;
+}
+
+/* Fills in the blocks of block_cache that are still BLOCK_PENDING, from
+   what the map knows so far. The views are used to compare the few bytes
+   that the map cannot tell about. Returns the number of blocks that are
+   still pending. */
+int derive_blocks(struct diff_map *map, char *block_cache, int total_blocks,
+                  hex_offset bytes_per_block, int blocks_with_excess_byte,
+                  struct file_view *view_one, struct file_view *view_two)
+{
+	int i, pending = 0;
+
+	for (i = 0; i < total_blocks; i++) {
+		if (block_cache[i] != BLOCK_PENDING) continue;
+
+		block_cache[i] = derive_block(map,
+		                 block_offset(i, bytes_per_block,
+		                              blocks_with_excess_byte),
+		                 block_offset(i + 1, bytes_per_block,
+		                              blocks_with_excess_byte),
+		                 view_one, view_two);
+		if (block_cache[i] == BLOCK_PENDING) pending++;
+	}
+
+	return pending;
+}
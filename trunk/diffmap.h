@@ -0,0 +1,106 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEX_DIFFMAP
+#define HEX_DIFFMAP
+
+#include "general.h"
+#include "fileio.h"
+
+#define DIFF_CHUNK_SIZE 4096UL  /* Bytes summarized by one bit          */
+#define DIFF_BATCH_CHUNKS 256UL /* Chunks scanned as a unit (whole words) */
+
+#define DIFF_FIRST_RANGES 4UL   /* Room a batch starts with for ranges */
+
+/* Bytes covered by a batch, wide enough to multiply by a batch number. */
+#define DIFF_BATCH_SIZE ((hex_offset) DIFF_BATCH_CHUNKS * DIFF_CHUNK_SIZE)
+
+#define WORD_BITS (sizeof(unsigned long) * 8)
+
+/* A run of differing bytes, [start, end). Its first and last bytes
+   differ, and the equal bytes within it are too few to tell two runs
+   apart (see span_difference()). */
+struct diff_range {
+	hex_offset start;
+	hex_offset end;
+};
+
+/* The ranges found in one batch, in order. The list starts with room
+   for a few of them and grows as needed, so that the ranges stay exact
+   however dense the differences. */
+struct range_list {
+	struct diff_range *ranges;
+	unsigned long count;
+	unsigned long capacity;      /* Room in ranges                    */
+	struct diff_range single;    /* Room for one, if memory runs out  */
+};
+
+/* A summary of the differences between two files that does not depend on
+   the size of the terminal. The files are cut into chunks of
+   DIFF_CHUNK_SIZE bytes, and a bit tells whether each chunk differs. The
+   overview blocks are derived from it, whatever their number. Each chunk
+   of either file also gets a fingerprint, so that the map can be checked
+   and reused without comparing the files again. The bytes lying in runs of
+   differences are counted under every word of bits, to tell a few
+   flipped bytes from a rewritten area. Finally, the exact ranges of
+   differing bytes are kept in a sorted list, to jump from one to the
+   next. */
+struct diff_map {
+	hex_offset size;             /* Size of the largest file          */
+	unsigned long chunk_count;   /* Chunks covering that size         */
+	unsigned long batch_count;   /* Batches covering those chunks     */
+	unsigned long word_count;    /* Words holding the bits            */
+	unsigned long *bits;         /* One bit per differing chunk       */
+	unsigned long *ranks;        /* Set bits before each word         */
+	unsigned long *weights;      /* Differing bytes under each word   */
+	hex_offset *prints_one;      /* Fingerprint of each chunk of one  */
+	hex_offset *prints_two;      /* ... and of file two               */
+	struct range_list *batch_ranges; /* Ranges found in each batch    */
+	struct diff_range *ranges;   /* All of them, once complete        */
+	unsigned long range_count;   /* Number of those                   */
+	volatile char *batch_done;   /* Which batches were scanned        */
+	int complete;                /* All batches were scanned          */
+	unsigned char *index;        /* Index the map was loaded from     */
+	unsigned long index_size;    /* Size of its mapping               */
+};
+
+int join_range(struct diff_range *range, hex_offset start, hex_offset end);
+void init_diff_map(struct diff_map *map, hex_offset size);
+struct diff_map *new_diff_map(hex_offset size);
+void free_diff_map(struct diff_map *map);
+void finish_diff_map(struct diff_map *map);
+void mark_batch_done(struct diff_map *map, unsigned long batch);
+void copy_batch(struct diff_map *map, struct diff_map *previous,
+                unsigned long batch);
+void mark_difference(struct diff_map *map, unsigned long batch,
+                     hex_offset start, hex_offset end);
+int chunk_differs(struct diff_map *map, unsigned long chunk);
+int next_difference(struct diff_map *map, hex_offset offset,
+                    hex_offset *found);
+int previous_difference(struct diff_map *map, hex_offset offset,
+                        hex_offset *found);
+
+hex_offset block_offset(int block, hex_offset bytes_per_block,
+                        int blocks_with_excess_byte);
+int offset_block(hex_offset offset, int total_blocks,
+                 hex_offset bytes_per_block, int blocks_with_excess_byte);
+char heat_level(hex_offset weight, hex_offset area);
+char compare_range(struct file_view *view_one, struct file_view *view_two,
+                   hex_offset start, hex_offset end);
+int derive_blocks(struct diff_map *map, char *block_cache, int total_blocks,
+                  hex_offset bytes_per_block, int blocks_with_excess_byte,
+                  struct file_view *view_one, struct file_view *view_two);
+
+#endif
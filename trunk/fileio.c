@@ -0,0 +1,408 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "fileio.h"
+
+#ifdef HEX_POSIX
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Serializes the views that have to share the stdio stream of a file. */
+static pthread_mutex_t stdio_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* #####################################################################
+   ##                    PLATFORM MAPPING HELPERS                     ##
+   ##################################################################### */
+
+#ifdef HEX_POSIX
+
+static unsigned long page_size(void)
+{
+	static unsigned long size = 0;
+	if (size == 0) size = (unsigned long) sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+static void advise_memory(unsigned char *address, unsigned long length,
+                          int advice)
+{
+	int flag;
+
+	switch (advice) {
+		case ADVISE_SEQUENTIAL: flag = MADV_SEQUENTIAL; break;
+		case ADVISE_RANDOM:     flag = MADV_RANDOM;     break;
+		default:                flag = MADV_WILLNEED;   break;
+	}
+	madvise(address, length, flag);
+}
+
+#endif
+
+/* #####################################################################
+   ##                     OPENING/CLOSING FILES                       ##
+   ##################################################################### */
+
+/* Opens file->name and fills in the remaining fields. Returns 0 on
+   success. */
+int open_file(struct file *file)
+{
+	file->map = NULL;
+	file->mappable = 0;
+
+	if ((file->pointer = fopen(file->name, "rb")) == NULL) return 1;
+
+	/* Get the file size */
+#ifdef HEX_POSIX
+	fseeko(file->pointer, 0, SEEK_END);
+	file->size = ftello(file->pointer);
+#else
+	fseek(file->pointer, 0, SEEK_END);
+	file->size = ftell(file->pointer);
+#endif
+
+#ifdef HEX_POSIX
+	/* Map the whole file if the address space is large enough for it.
+	   On 32-bit builds, views map a sliding window instead. */
+	if (file->size > 0) {
+		void *map;
+		size_t length = (size_t) file->size;
+
+		if (sizeof(void *) < 8 || length != file->size)
+			length = page_size();
+		map = mmap(NULL, length, PROT_READ, MAP_SHARED,
+		           fileno(file->pointer), 0);
+		if (map != MAP_FAILED) {
+			file->mappable = 1;
+			if (length == file->size) {
+				file->map = map;
+			} else {
+				munmap(map, length);
+			}
+		}
+	}
+#endif
+
+	return 0;
+}
+
+void close_file(struct file *file)
+{
+#ifdef HEX_POSIX
+	if (file->map != NULL) munmap(file->map, (size_t) file->size);
+#endif
+	file->map = NULL;
+	if (file->pointer != NULL) fclose(file->pointer);
+	file->pointer = NULL;
+}
+
+/* Tells the system how a range of a whole-file mapping is going to be
+   used. Does nothing for files that are not mapped. */
+void advise_file(struct file *file, hex_offset offset, hex_offset length,
+                 int advice)
+{
+#ifdef HEX_POSIX
+	unsigned long skew;
+
+	if (file->map == NULL || offset >= file->size) return;
+	if (length > file->size - offset) length = file->size - offset;
+
+	skew = offset % page_size();
+	advise_memory(file->map + offset - skew, (unsigned long) length + skew,
+	              advice);
+#else
+	(void) file; (void) offset; (void) length; (void) advice;
+#endif
+}
+
+/* #####################################################################
+   ##                          FILE VIEWS                             ##
+   ##################################################################### */
+
+/* Prepares a view of file. capacity bounds the memory the view holds at
+   any time when the file is not mapped in full. */
+void init_view(struct file_view *view, struct file *file,
+               unsigned long capacity, int advice)
+{
+	view->file = file;
+	view->data = NULL;
+	view->start = 0;
+	view->length = 0;
+	view->advice = advice;
+	view->descriptor = -1;
+	view->reads = 0;
+	view->bytes_read = 0;
+
+	/* Nothing can be read from an empty file, so its view needs neither
+	   a descriptor nor a buffer. */
+	if (file->size == 0) {
+		view->type = VIEW_BUFFER;
+		view->capacity = 0;
+		return;
+	}
+
+	if (file->map != NULL) {
+		view->type = VIEW_MAPPED;
+		view->capacity = capacity;
+		return;
+	}
+
+#ifdef HEX_POSIX
+	view->descriptor = open(file->name, O_RDONLY);
+
+	if (file->mappable && view->descriptor >= 0) {
+		/* Windows must start on a page boundary and span at least two
+		   pages, so that any offset falls inside a freshly mapped
+		   window. */
+		view->type = VIEW_WINDOW;
+		capacity = (capacity + page_size() - 1) / page_size()
+		           * page_size();
+		if (capacity < page_size() * 2) capacity = page_size() * 2;
+		view->capacity = capacity;
+		return;
+	}
+#endif
+
+	view->type = VIEW_BUFFER;
+	view->capacity = capacity;
+	view->data = malloc(capacity);
+}
+
+void free_view(struct file_view *view)
+{
+#ifdef HEX_POSIX
+	if (view->type == VIEW_WINDOW && view->data != NULL)
+		munmap(view->data, view->length);
+	if (view->descriptor >= 0) close(view->descriptor);
+	view->descriptor = -1;
+#endif
+	if (view->type == VIEW_BUFFER) free(view->data);
+	view->data = NULL;
+	view->length = 0;
+}
+
+/* Makes the window or buffer of the view hold the given offset. Returns
+   0 on success. */
+static int load_view(struct file_view *view, hex_offset offset)
+{
+	struct file *file = view->file;
+
+#ifdef HEX_POSIX
+	if (view->type == VIEW_WINDOW) {
+		void *window;
+		hex_offset start = offset - offset % page_size();
+		unsigned long length = view->capacity;
+
+		if (length > file->size - start) length = file->size - start;
+		if (view->data != NULL) munmap(view->data, view->length);
+		view->data = NULL;
+		view->length = 0;
+
+		window = mmap(NULL, length, PROT_READ, MAP_SHARED,
+		              view->descriptor, (off_t) start);
+		view->reads++;
+		if (window != MAP_FAILED) {
+			view->data = window;
+			view->start = start;
+			view->length = length;
+			advise_memory(view->data, length, view->advice);
+			return 0;
+		}
+
+		/* The window could not be mapped: use a buffer instead. */
+		view->type = VIEW_BUFFER;
+		view->data = malloc(view->capacity);
+	}
+#endif
+
+	if (view->data == NULL) return 1;
+	view->start = offset;
+	view->length = 0;
+
+#ifdef HEX_POSIX
+	if (view->descriptor >= 0) {
+		while (view->length < view->capacity) {
+			ssize_t bytes_read;
+			bytes_read = pread(view->descriptor,
+			                   view->data + view->length,
+			                   view->capacity - view->length,
+			                   (off_t) (offset + view->length));
+			view->reads++;
+			if (bytes_read <= 0) break;
+			view->length += bytes_read;
+		}
+		return (view->length == 0);
+	}
+
+	pthread_mutex_lock(&stdio_lock);
+	fseeko(file->pointer, (off_t) offset, SEEK_SET);
+#else
+	fseek(file->pointer, (long) offset, SEEK_SET);
+#endif
+	view->length = fread(view->data, 1, view->capacity, file->pointer);
+	view->reads++;
+#ifdef HEX_POSIX
+	pthread_mutex_unlock(&stdio_lock);
+#endif
+	return (view->length == 0);
+}
+
+#ifdef HEX_POSIX
+
+/* Drops the whole pages of a mapped view between its start and end from
+   the mapping. */
+static void drop_pages(struct file_view *view, hex_offset end)
+{
+	hex_offset start = view->start + page_size() - 1;
+
+	start -= start % page_size();
+	end -= end % page_size();
+	if (end > start)
+		madvise(view->file->map + start, (size_t) (end - start),
+		        MADV_DONTNEED);
+}
+
+#endif
+
+/* Returns a pointer to the bytes of the file at offset. *available is set
+   to how many of the wanted bytes can be read from that pointer; it is
+   only 0 past the end of the file (or on read errors). Whenever possible,
+   the pointer refers directly to the page cache and no copy is made. */
+const unsigned char *read_view(struct file_view *view, hex_offset offset,
+                               hex_offset wanted, unsigned long *available)
+{
+	struct file *file = view->file;
+	unsigned long left;
+
+	*available = 0;
+	if (offset >= file->size || wanted == 0) return NULL;
+	if (wanted > file->size - offset) wanted = file->size - offset;
+
+	if (view->type == VIEW_MAPPED) {
+#ifdef HEX_POSIX
+		/* When streaming through the file, drop the pages we are
+		   done with from our mapping, so that the resident set does
+		   not grow with the file size. The data stays in the page
+		   cache. The mapping is shared by every view of the file, so
+		   only the stretch this view has read in order, from start
+		   for length bytes, is ever dropped: a read elsewhere drops
+		   that stretch and starts another. */
+		if (view->advice == ADVISE_SEQUENTIAL) {
+			hex_offset end = view->start + view->length;
+
+			if (offset < view->start || offset > end) {
+				drop_pages(view, end);
+				view->start = end = offset;
+			} else if (offset >= view->start + view->capacity) {
+				drop_pages(view, offset);
+				view->start = offset - offset % page_size();
+			}
+			if (end < offset + wanted) end = offset + wanted;
+			view->length = (unsigned long) (end - view->start);
+		}
+#endif
+		*available = (unsigned long) wanted;
+		view->bytes_read += wanted;
+		return file->map + offset;
+	}
+
+	/* Reload the window or buffer if the offset falls outside of it. */
+	if (offset < view->start || offset >= view->start + view->length) {
+		if (load_view(view, offset) != 0) return NULL;
+	}
+
+	left = (unsigned long) (view->start + view->length - offset);
+	*available = (wanted < left) ? (unsigned long) wanted : left;
+	view->bytes_read += *available;
+	return view->data + (offset - view->start);
+}
+
+/* Copies up to length bytes of the file from offset into buffer, and
+   returns how many were copied. Unlike read_view(), this takes a single
+   read whatever the size of the view, so that a caller keeping its own
+   copy of some bytes pays one system call for them. */
+unsigned long copy_view(struct file_view *view, hex_offset offset,
+                        unsigned char *buffer, unsigned long length)
+{
+	struct file *file = view->file;
+	unsigned long copied = 0;
+
+	if (offset >= file->size) return 0;
+	if (length > file->size - offset)
+		length = (unsigned long) (file->size - offset);
+
+	if (view->type == VIEW_MAPPED) {
+		memcpy(buffer, file->map + offset, length);
+		view->bytes_read += length;
+		return length;
+	}
+
+#ifdef HEX_POSIX
+	if (view->descriptor >= 0) {
+		while (copied < length) {
+			ssize_t bytes_read;
+			bytes_read = pread(view->descriptor, buffer + copied,
+			                   length - copied,
+			                   (off_t) (offset + copied));
+			view->reads++;
+			if (bytes_read <= 0) break;
+			copied += bytes_read;
+		}
+		view->bytes_read += copied;
+		return copied;
+	}
+
+	pthread_mutex_lock(&stdio_lock);
+	fseeko(file->pointer, (off_t) offset, SEEK_SET);
+#else
+	fseek(file->pointer, (long) offset, SEEK_SET);
+#endif
+	copied = fread(buffer, 1, length, file->pointer);
+#ifdef HEX_POSIX
+	pthread_mutex_unlock(&stdio_lock);
+#endif
+	view->reads++;
+	view->bytes_read += copied;
+	return copied;
+}
+
+/* #####################################################################
+   ##                      PRINTING OFFSETS                           ##
+   ##################################################################### */
+
+/* Writes an offset into buffer in the given base (10 or 16), padded with
+   zeros to at least digits digits, and returns buffer. printf() cannot be
+   relied on for numbers wider than a long in C89. The buffer must hold
+   OFFSET_DIGITS characters. */
+char *format_offset(char *buffer, hex_offset value, int base, int digits)
+{
+	char reversed[OFFSET_DIGITS];
+	int length = 0, i = 0;
+
+	do {
+		reversed[length++] = "0123456789abcdef"[value % base];
+		value /= base;
+	} while (value != 0);
+
+	if (digits > OFFSET_DIGITS - 1) digits = OFFSET_DIGITS - 1;
+	for (; digits > length; digits--) buffer[i++] = '0';
+	while (length > 0) buffer[i++] = reversed[--length];
+	buffer[i] = 0;
+	return buffer;
+}
@@ -0,0 +1,69 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEX_FILEIO
+#define HEX_FILEIO
+
+#include "general.h"
+
+#define ADVISE_SEQUENTIAL 0     /* Data is about to be read in order  */
+#define ADVISE_RANDOM 1         /* Data is read at scattered offsets  */
+#define ADVISE_WILLNEED 2       /* Data will be needed very soon      */
+
+#define VIEW_BUFFER 0           /* Bytes are copied into a heap buffer */
+#define VIEW_WINDOW 1           /* A sliding window of the file is mapped */
+#define VIEW_MAPPED 2           /* The whole file is mapped */
+
+#define HEX_VIEW_SIZE (64UL * 1024) /* Window/buffer size of the hex view */
+
+#define OFFSET_DIGITS 24        /* Room for an offset written out     */
+
+/* A view gives access to the bytes of a file at any offset. Depending on
+   what the platform allows, it hands out pointers straight into the page
+   cache or into a buffer it fills with pread() or stdio. Each consumer (a
+   scan thread, the hex view...) owns its own view, and a view that is not
+   backed by the whole-file mapping has its own descriptor, so that views
+   can be used from several threads at once. Memory mapping is only
+   attempted on POSIX systems; stdio is used everywhere else, and for
+   inputs that cannot be mapped (pipes, some special files...). */
+struct file_view {
+	struct file *file;      /* File being viewed                 */
+	unsigned char *data;    /* Window mapping or buffer          */
+	hex_offset start;       /* File offset of data[0], or of the */
+	unsigned long length;   /* bytes read in order when mapped;  */
+	                        /* number of valid bytes from there  */
+	unsigned long capacity; /* Size of the window or buffer      */
+	int type;               /* VIEW_BUFFER/VIEW_WINDOW/VIEW_MAPPED */
+	int advice;             /* ADVISE_SEQUENTIAL or ADVISE_RANDOM */
+	int descriptor;         /* Private descriptor, or -1 for stdio */
+	unsigned long reads;    /* System calls made to read the file */
+	hex_offset bytes_read;  /* Bytes handed out or copied so far */
+};
+
+int open_file(struct file *file);
+void close_file(struct file *file);
+void advise_file(struct file *file, hex_offset offset, hex_offset length,
+                 int advice);
+
+void init_view(struct file_view *view, struct file *file,
+               unsigned long capacity, int advice);
+void free_view(struct file_view *view);
+const unsigned char *read_view(struct file_view *view, hex_offset offset,
+                               hex_offset wanted, unsigned long *available);
+unsigned long copy_view(struct file_view *view, hex_offset offset,
+                        unsigned char *buffer, unsigned long length);
+char *format_offset(char *buffer, hex_offset value, int base, int digits);
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fingerprint.h"
+#include "compare.h"
+
+#ifdef HEX_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/* Every chunk of both files gets a fingerprint, so that a chunk can be
+   told to be as it was, or the same as in another file, without the
+   bytes it is compared with. It is the CRC-64 of its bytes (the one xz
+   uses, reflected, with all bits set before and after): 64 bits keep
+   the odds of two different chunks passing for the same one negligible,
+   even among the millions of chunks of large files, where 32 would not.
+   It is built from 32-bit halves, as hex_offset may not take a 64-bit
+   constant. */
+#define WIDE(high, low) (((hex_offset) (high) << 32) | (hex_offset) (low))
+#define POLYNOMIAL WIDE(0xC96C5795UL, 0xD7870F42UL)
+
+/* Remainders of every byte, and of every byte followed by one to seven
+   zero bytes, so that eight bytes are taken at a time. */
+static hex_offset remainders[8][256];
+
+/* #####################################################################
+   ##                  PORTABLE FINGERPRINT KERNEL                    ##
+   ##################################################################### */
+
+static void init_remainders(void)
+{
+	hex_offset remainder;
+	int byte, bit, i;
+
+	for (byte = 0; byte < 256; byte++) {
+		remainder = byte;
+		for (bit = 0; bit < 8; bit++)
+			remainder = (remainder >> 1) ^
+			            ((remainder & 1) ? POLYNOMIAL : 0);
+		remainders[0][byte] = remainder;
+	}
+	for (i = 1; i < 8; i++)
+		for (byte = 0; byte < 256; byte++) {
+			remainder = remainders[i - 1][byte];
+			remainders[i][byte] = (remainder >> 8) ^
+			                      remainders[0][remainder & 0xFF];
+		}
+}
+
+/* Takes eight bytes at a time, looking up the remainder of each of them
+   at its distance from the end in a table of its own. */
+static hex_offset extend_fingerprint_table(hex_offset print,
+                                           const unsigned char *data,
+                                           unsigned long length)
+{
+	hex_offset crc = ~print, word;
+	int i;
+
+	for (; length >= 8; data += 8, length -= 8) {
+		for (word = 0, i = 7; i >= 0; i--)
+			word = (word << 8) | data[i];
+		crc ^= word;
+		for (word = 0, i = 0; i < 8; i++, crc >>= 8)
+			word ^= remainders[7 - i][crc & 0xFF];
+		crc = word;
+	}
+	for (; length > 0; data++, length--)
+		crc = (crc >> 8) ^ remainders[0][(crc ^ *data) & 0xFF];
+	return ~crc;
+}
+
+/* #####################################################################
+   ##                      x86 VECTOR KERNEL                          ##
+   ##################################################################### */
+
+#ifdef HEX_X86_KERNELS
+
+/* Multiplying 128 bits by x^n modulo the polynomial, with carry-less
+   multiplication, moves them n bits further on without changing their
+   remainder. Each pair of constants does it for one distance, n, for the
+   low and the high half of the bits, as bit-reversed x^(n+63) and
+   x^(n-1). */
+#define FOLD_512 WIDE(0x081F6054UL, 0xA7842DF4UL), \
+                 WIDE(0x6AE3EFBBUL, 0x9DD441F3UL)
+#define FOLD_384 WIDE(0x69A35D91UL, 0xC3730254UL), \
+                 WIDE(0xB5EA1AF9UL, 0xC013ACA4UL)
+#define FOLD_256 WIDE(0x3BE653A3UL, 0x0FE1AF51UL), \
+                 WIDE(0x60095B00UL, 0x8A9EFA44UL)
+#define FOLD_128 WIDE(0xDABE95AFUL, 0xC7875F40UL), \
+                 WIDE(0xE05DD497UL, 0xCA393AE4UL)
+
+__attribute__((target("pclmul,sse2")))
+static __m128i fold(__m128i bits, hex_offset high, hex_offset low)
+{
+	__m128i constants = _mm_set_epi64x(high, low);
+
+	return _mm_xor_si128(_mm_clmulepi64_si128(bits, constants, 0x00),
+	                     _mm_clmulepi64_si128(bits, constants, 0x11));
+}
+
+/* Keeps four lanes of 128 bits, each folded 512 bits further on at
+   every 64 bytes, which keeps the multiplier busy. The lanes are then
+   folded into one, whose remainder the table finishes off along with
+   the bytes left over. */
+__attribute__((target("pclmul,sse2")))
+static hex_offset extend_fingerprint_pclmul(hex_offset print,
+                                            const unsigned char *data,
+                                            unsigned long length)
+{
+	const __m128i *block = (const __m128i *) data;
+	unsigned char folded[16];
+	unsigned long done;
+	__m128i lanes[4];
+	int i;
+
+	if (length < 64)
+		return extend_fingerprint_table(print, data, length);
+
+	for (i = 0; i < 4; i++)
+		lanes[i] = _mm_loadu_si128(block + i);
+	lanes[0] = _mm_xor_si128(lanes[0], _mm_set_epi64x(0, ~print));
+	for (done = 64; done + 64 <= length; done += 64) {
+		block = (const __m128i *) (data + done);
+		for (i = 0; i < 4; i++)
+			lanes[i] = _mm_xor_si128(fold(lanes[i], FOLD_512),
+			                         _mm_loadu_si128(block + i));
+	}
+
+	lanes[3] = _mm_xor_si128(lanes[3], fold(lanes[0], FOLD_384));
+	lanes[3] = _mm_xor_si128(lanes[3], fold(lanes[1], FOLD_256));
+	lanes[3] = _mm_xor_si128(lanes[3], fold(lanes[2], FOLD_128));
+	_mm_storeu_si128((__m128i *) folded, lanes[3]);
+
+	print = extend_fingerprint_table(~(hex_offset) 0, folded, 16);
+	return extend_fingerprint_table(print, data + done, length - done);
+}
+
+#endif
+
+/* #####################################################################
+   ##                      KERNEL SELECTION                           ##
+   ##################################################################### */
+
+fingerprint_kernel extend_fingerprint = extend_fingerprint_table;
+static const char *kernel_name = "table";
+
+/* Builds the tables, and picks the fastest kernel the processor
+   supports. Called once at startup, before any fingerprint is made. */
+void init_fingerprint(void)
+{
+	init_remainders();
+#ifdef HEX_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul")) {
+		extend_fingerprint = extend_fingerprint_pclmul;
+		kernel_name = "pclmul";
+	}
+#endif
+}
+
+const char *fingerprint_kernel_name(void)
+{
+	return kernel_name;
+}
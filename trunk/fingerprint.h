@@ -0,0 +1,33 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEX_FINGERPRINT
+#define HEX_FINGERPRINT
+
+#include "general.h"
+
+/* Returns the fingerprint of the bytes fingerprinted so far, print,
+   followed by the given ones. The fingerprint of nothing is 0, so that
+   a fingerprint can be built up a piece at a time. */
+typedef hex_offset (*fingerprint_kernel)(hex_offset print,
+                                         const unsigned char *data,
+                                         unsigned long length);
+
+extern fingerprint_kernel extend_fingerprint;
+
+void init_fingerprint(void);
+const char *fingerprint_kernel_name(void);
+
+#endif
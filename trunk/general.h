@@ -20,10 +20,52 @@
 
 #define PVER "1.0.4"
 
+/* POSIX systems get memory mapping, pread() and worker threads. Other
+   platforms (DOS) read through stdio and do all the work on one thread. */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__DJGPP__)
+#define HEX_POSIX
+#endif
+
+/* Default and minimum amount of memory the overview scan may use for its
+   read buffers, in bytes. The limit covers both files together. */
+#define DEFAULT_SCAN_MEMORY (4UL * 1024 * 1024)
+#define MIN_SCAN_MEMORY     (2UL * 1024)
+
+/* What --report prints, if anything. */
+#define REPORT_NONE 0           /* Start the interactive display     */
+#define REPORT_TEXT 1           /* One line per range of differences */
+#define REPORT_JSON 2           /* A JSON document                   */
+
+/* File sizes and offsets. They are 64 bits wide wherever the compiler
+   has such a type, so that files larger than 4 GiB can be compared on
+   32-bit systems as well. */
+#ifdef __GNUC__
+__extension__ typedef unsigned long long hex_offset;
+#else
+typedef unsigned long hex_offset;
+#endif
+
 struct file {
-	char *name;           /* File name       */
-	FILE *pointer;        /* File descriptor */
-	unsigned long size;   /* File size       */
+	char *name;           /* File name                             */
+	FILE *pointer;        /* File descriptor                       */
+	hex_offset size;      /* File size                             */
+	unsigned char *map;   /* Mapping of the whole file, or NULL    */
+	int mappable;         /* Windows of the file can be mapped     */
+};
+
+struct signature;
+
+struct options {
+	unsigned long scan_memory;  /* Memory ceiling of the overview scan */
+	int threads;                /* Worker threads of the overview scan */
+	int use_index;              /* Reuse and save the difference index */
+	int report;                 /* REPORT_NONE, _TEXT or _JSON         */
+	unsigned long report_bytes; /* Bytes of each range to report       */
+	int align;                  /* Follow insertions and deletions     */
+	int moves;                  /* Look for data moved elsewhere       */
+	int make_signature;         /* Write the signature of file one     */
+	char *signature_name;       /* Signature named by --signature      */
+	struct signature *signature; /* Stands in for file two, or NULL    */
 };
 
 #endif
@@ -14,15 +14,28 @@
  */
 
 #include "gui.h"
+#include "fileio.h"
+#include "scan.h"
+#include "index.h"
+#include "prefetch.h"
+#include "align.h"
+#include "chunk.h"
+#include "bytediff.h"
+#include "job.h"
+
+#ifdef HEX_UNICODE
+#include <locale.h>
+#include <langinfo.h>
+#endif
 
 /* #####################################################################
    ##              ANCILLARY MATHEMATICAL FUNCTIONS                   ##
    ##################################################################### */
 
 static void calculate_dimensions(int *width, int *height, int *total_blocks,
-                          unsigned long *bytes_per_block,
-                          unsigned long largest_file_size,
-                          int *blocks_with_excess_byte)
+                          hex_offset *bytes_per_block,
+                          hex_offset largest_file_size,
+                          int *blocks_with_excess_byte, int cell_blocks)
 {
 	/* Acquire the dimensions of window */
 	getmaxyx(stdscr, *height, *width);
@@ -38,47 +51,33 @@ static void calculate_dimensions(int *width, int *height, int *total_blocks,
 	/* Calculate how many bytes are held in a block.
 	   Each block holds a minimum of one byte. The number is
 	   biggest file size / # blocks ((width-SIDE_MARGIN) * (height-11))
-	   rounded to the next number up. */
+	   rounded to the next number up. Cells may show several blocks,
+	   one above the other. */
 	*total_blocks = (*width - SIDE_MARGIN*2) *
-	                (*height - VERTICAL_BLACK_SPACE);
-	*bytes_per_block = (unsigned long) largest_file_size /
-	                   (*total_blocks);
-	*blocks_with_excess_byte = (unsigned long) largest_file_size %
-	                   (*total_blocks);
+	                (*height - VERTICAL_BLACK_SPACE) * cell_blocks;
+	*bytes_per_block = largest_file_size / (*total_blocks);
+	*blocks_with_excess_byte = (int) (largest_file_size %
+	                           (*total_blocks));
 
 	return;
 }
 
-static int calculate_current_block(int total_blocks, unsigned long file_offset,
-                            unsigned long *offset_index)
+static int calculate_current_block(int total_blocks, hex_offset file_offset,
+                            hex_offset bytes_per_block,
+                            int blocks_with_excess_byte)
 {
-	/* With a given offset, calculate which element it corresponds to
-	   in the offset_index. */
-	int i, current_block = 0;
-	for (i = 0; i < total_blocks; i++) {
-
-		/* Go block by block, and see if our offset is greater than
-		   that of the block's. */
-		if (file_offset >= offset_index[i]) {
-			current_block = i;
-		} else {
-			break;
-		}
-
-		/* Break if we reach EOF. */
-		if ((i+1 < total_blocks) && (offset_index[i+1] == offset_index[i]))
-		break;
-	}
-
-	return current_block;
+	/* With a given offset, calculate which block it falls in. The
+	   blocks are laid out evenly, so this is worked out rather than
+	   searched for. */
+	return offset_block(file_offset, total_blocks, bytes_per_block,
+	                    blocks_with_excess_byte);
 }
 
 /* computes the width of the hex offset margin on the left */
-static int calculate_max_offset_characters(unsigned long fsz)
+static int calculate_max_offset_characters(hex_offset fsz)
 {
-	char s[32];
-	sprintf(s, "%lX", fsz);
-	return(strlen(s));
+	char s[OFFSET_DIGITS];
+	return(strlen(format_offset(s, fsz, 16, 0)));
 }
 
 /* #####################################################################
@@ -95,10 +94,10 @@ static char raw_to_ascii(char input)
    ##                      HANDLE MOUSE ACTIONS                       ##
    ##################################################################### */
 
-static void mouse_clicked(unsigned long *file_offset, unsigned long
-                   *offset_index, int width, int height,
-                   int total_blocks, char *mode,
-                   int mouse_x, int mouse_y, int action)
+static void mouse_clicked(hex_offset *file_offset,
+                   hex_offset bytes_per_block, int blocks_with_excess_byte,
+                   int width, int height, int total_blocks, char *mode,
+                   int mouse_x, int mouse_y, int action, int cell_blocks)
 {
 	int index;
 
@@ -113,13 +112,15 @@ static void mouse_clicked(unsigned long *file_offset, unsigned long
 			|| mouse_y < 2 || mouse_y > height - 8)
 			return;
 
-		/* Calculate the box it falls in. */
-		index = (width-SIDE_MARGIN*2) * (mouse_y-2) +
+		/* Calculate the box it falls in: the top one, if the cell
+		   shows several. */
+		index = (width-SIDE_MARGIN*2) * (mouse_y-2) * cell_blocks +
 					mouse_x-SIDE_MARGIN;
 
 		/* Set the offset to the value in the box. */
 		if (index < total_blocks && index >= 0)
-			*file_offset = offset_index[index];
+			*file_offset = block_offset(index, bytes_per_block,
+			                            blocks_with_excess_byte);
 
 		/* If double-clicked, set to HEX MODE. */
 		if (action == BUTTON1_DOUBLE_CLICKED)
@@ -134,35 +135,104 @@ static void mouse_clicked(unsigned long *file_offset, unsigned long
    ##                      GENERATE TITLE BAR                         ##
    ##################################################################### */
 
-static void generate_titlebar(struct file *file_one, struct file *file_two,
-                       unsigned long file_offset, int width, int height,
-                       char mode, int display)
+/* Describes the progress of a running scan, e.g. "37% 512.0 MiB/s ETA
+   0:42". */
+static void format_scan_status(char *status, struct scan_progress *progress)
+{
+	double percent = 100.0, rate = 0, eta;
+
+	if (progress->bytes_total > 0)
+		percent = 100.0 * progress->bytes_done / progress->bytes_total;
+	if (progress->seconds > 0)
+		rate = progress->bytes_done / progress->seconds;
+
+	if (rate > 0) {
+		eta = (progress->bytes_total - progress->bytes_done) / rate;
+		sprintf(status, " %d%% %.1f MiB/s ETA %lu:%02lu ",
+		        (int) percent, rate / (1024 * 1024),
+		        (unsigned long) eta / 60, (unsigned long) eta % 60);
+	} else {
+		sprintf(status, " %d%% scanning... ", (int) percent);
+	}
+}
+
+static void generate_titlebar(WINDOW *window, struct file *file_one,
+                              struct file *file_two, hex_offset file_offset,
+                              hex_offset second_offset, int width,
+                              char *scan_status)
 {
 	int i;
-	char title_offset[32];
-	char bottom_message[128];
+	char title_offset[64], digits[OFFSET_DIGITS];
 
-	/* Define and set colour for the title bar. */
-	init_pair(TITLE_BAR, COLOR_BLACK, COLOR_WHITE);
-	attron(COLOR_PAIR(TITLE_BAR) | A_BOLD);
+	wattron(window, COLOR_PAIR(TITLE_BAR) | A_BOLD);
 
 	/* Create the title bar background. */
-	for (i = 0; i < width; i++) {
-		mvprintw(0, i, " ");
-		mvprintw(height-1, i, " ");
-	}
+	for (i = 0; i < width; i++) mvwprintw(window, 0, i, " ");
 
 	/* Create the title. */
-	mvprintw(0, SIDE_MARGIN, "hexcompare: %s vs. %s",
-	         file_one->name, file_two->name);
+	mvwprintw(window, 0, SIDE_MARGIN, "hexcompare: %s vs. %s",
+	          file_one->name, file_two->name);
 
 	/* Indicate file offset. */
-	sprintf(title_offset, " 0x%04x", (unsigned int) file_offset);
-	mvprintw(0, width-strlen(title_offset)-SIDE_MARGIN, "%s",
-	         title_offset);
+	sprintf(title_offset, " 0x%s",
+	        format_offset(digits, file_offset, 16, 4));
+
+	/* Aligned, file two may be shown from elsewhere. */
+	if (second_offset != file_offset)
+		sprintf(title_offset + strlen(title_offset), " / 0x%s",
+		        format_offset(digits, second_offset, 16, 4));
+	mvwprintw(window, 0, width-strlen(title_offset)-SIDE_MARGIN, "%s",
+	          title_offset);
+
+	/* While the overview is being built, show how far along it is. */
+	if (scan_status[0] != 0) {
+		mvwprintw(window, 0, width - strlen(title_offset) -
+		          strlen(scan_status) - SIDE_MARGIN, "%s",
+		          scan_status);
+	}
+
+	/* Set the colour scheme back to default. */
+	wattroff(window, COLOR_PAIR(TITLE_BAR) | A_BOLD);
+
+	return;
+}
+
+/* Describes the progress of a job after what status holds already,
+   e.g. "Aligning 37%". */
+static void format_job_status(char *status, const char *name,
+                              struct scan_progress *progress)
+{
+	int percent = 100;
+
+	if (progress->bytes_total > 0)
+		percent = (int) (100.0 * progress->bytes_done /
+		                 progress->bytes_total);
+	sprintf(status + strlen(status), " %s %d%% ", name, percent);
+}
+
+/* Appends a key to the menu if it leaves room for the text that ends
+   it. */
+static void add_menu_key(char *message, const char *key, const char *end,
+                         int room)
+{
+	if ((int) (strlen(message) + strlen(key) + strlen(end)) <= room)
+		strcat(message, key);
+}
+
+static void generate_menu(WINDOW *window, int width, char mode,
+                          int display, int keys, const char *job_status)
+{
+	int i, room = width - SIDE_MARGIN * 2 - strlen(job_status);
+	char bottom_message[256];
+	const char *end;
+
+	wattron(window, COLOR_PAIR(TITLE_BAR) | A_BOLD);
+
+	/* Create the menu background. */
+	for (i = 0; i < width; i++) mvwprintw(window, 0, i, " ");
 
 	/* Write bottom menu options. */
-	strcpy(bottom_message, "Quit: q | ");
+	strcpy(bottom_message, "Quit: q | Diff: n/p | ");
 
 	if (display == HEX_VIEW) {
 		strcat(bottom_message, "Hex Mode: m | ");
@@ -171,15 +241,36 @@ static void generate_titlebar(struct file *file_one, struct file *file_two,
 	}
 
 	if (mode == OVERVIEW_MODE) {
-		strcat(bottom_message, "Full View: v | Page & Arrow Keys to Move");
+		strcat(bottom_message, "Full View: v | ");
+		end = "Page & Arrow Keys to Move";
 	} else {
-		strcat(bottom_message, "Mixed View: v | Arrow Keys to Move");
+		strcat(bottom_message, "Mixed View: v | ");
+		end = "Arrow Keys to Move";
 	}
 
-	mvprintw(height-1, SIDE_MARGIN, "%s", bottom_message);
-
-	/* Set the colour scheme back to default. */
-	attroff(COLOR_PAIR(TITLE_BAR) | A_BOLD);
+	/* The keys that are not always of use come last, as far as the
+	   width allows. The usage text lists them all. */
+	if (keys & MENU_DIFF)
+		add_menu_key(bottom_message, "Byte Diff: d | ", end, room);
+	if (keys & MENU_ALIGN)
+		add_menu_key(bottom_message, "Align: a | ", end, room);
+	if (keys & MENU_MOVES)
+		add_menu_key(bottom_message, "Moved: c | ", end, room);
+	if (keys & MENU_CELLS)
+		add_menu_key(bottom_message, "Cells: b | ", end, room);
+	if (keys & MENU_INFO)
+		add_menu_key(bottom_message, "Info: i | ", end, room);
+	strcat(bottom_message, end);
+
+	mvwprintw(window, 0, SIDE_MARGIN, "%s", bottom_message);
+
+	/* While jobs started by the display run, show how far along they
+	   are. */
+	if (job_status[0] != 0)
+		mvwprintw(window, 0, width - strlen(job_status) - SIDE_MARGIN,
+		          "%s", job_status);
+
+	wattroff(window, COLOR_PAIR(TITLE_BAR) | A_BOLD);
 
 	return;
 }
@@ -188,80 +279,40 @@ static void generate_titlebar(struct file *file_one, struct file *file_two,
    ##            GENERATE BLOCK DATA FOR OVERVIEW MODE                ##
    ##################################################################### */
 
-static char *generate_blocks(struct file *file_one, struct file *file_two,
-                 char *block_cache, int total_blocks,
-                 unsigned long bytes_per_block,
-                 int blocks_with_excess_byte)
+static char *generate_blocks(struct diff_map *map, char *block_cache,
+                 int total_blocks, hex_offset bytes_per_block,
+                 int blocks_with_excess_byte, struct file_view *view_one,
+                 struct file_view *view_two, struct alignment *alignment,
+                 struct chunk_map *chunks, int *pending_blocks)
 {
-	int i;
-	unsigned char *block_one, *block_two;
-
-	block_one = malloc(bytes_per_block + 1);
-	block_two = malloc(bytes_per_block + 1);
-
 	/* De-allocate existing memory that holds the block data. */
 	if (block_cache != NULL) free(block_cache);
 
 	/* Allocate the correct amount of memory and initialize it. */
 	block_cache = malloc(total_blocks);
-	memset(block_cache, BLOCK_EMPTY, total_blocks);
-
-	/* Seek to start of file. */
-	fseek(file_one->pointer, 0, SEEK_SET);
-	fseek(file_two->pointer, 0, SEEK_SET);
-
-	/* Compare bytes of file_one with file_two. Store results in */
-	/* a dynamically-sized block_cache. */
-	for (i = 0; i < total_blocks; i++) {
-		int bytes_read_one, bytes_read_two;
-		size_t bytes_in_block, j;
-
-		/* Calculate how many bytes to read for this block. */
-		if (i < blocks_with_excess_byte) {
-			bytes_in_block = bytes_per_block + 1;
-		} else {
-			bytes_in_block = bytes_per_block;
-		}
-
-		/* Set the default. */
-		block_cache[i] = BLOCK_SAME;
-
-		/* Clear the block of data. */
-		memset(block_one, '\0', bytes_in_block);
-		memset(block_two, '\0', bytes_in_block);
-
-		/* Read in the next block of data. */
-		bytes_read_one = fread(block_one, bytes_in_block,
-		                           1, file_one->pointer);
-		bytes_read_two = fread(block_two, bytes_in_block,
-		                           1, file_two->pointer);
-
-		/* Stop here if we read 0 bytes. Both files are fully read. */
-		if (bytes_read_one == 0 && bytes_read_two == 0) {
-			block_cache[i] = BLOCK_EMPTY;
-			break;
-		}
-
-		/* If the file lengths don't match up, we know the blocks are
-		   different. Go to the next block. */
-		if (bytes_read_one != bytes_read_two) {
-			block_cache[i] = BLOCK_DIFFERENT;
-			continue;
-		}
-
-		/* Both blocks have the same length. Compare them character by
-		   character. */
-		for (j = 0; j < bytes_in_block; j++) {
-			if (block_one[j] != block_two[j]) {
-				block_cache[i] = BLOCK_DIFFERENT;
-				break;
-			}
-		}
+	memset(block_cache, BLOCK_PENDING, total_blocks);
+
+	/* Aligned, the blocks follow from the alignment alone, which is
+	   known in full. */
+	if (alignment != NULL) {
+		align_blocks(alignment, block_cache, total_blocks,
+		             bytes_per_block, blocks_with_excess_byte);
+		*pending_blocks = 0;
+		return block_cache;
 	}
 
-	/* free memory */
-	free(block_one);
-	free(block_two);
+	/* Work out the blocks from the difference map. This doesn't read
+	   the files again, apart from a few bytes at the edges of blocks.
+	   The blocks the scan hasn't reached yet are left pending. */
+	*pending_blocks = derive_blocks(map, block_cache, total_blocks,
+	                                bytes_per_block,
+	                                blocks_with_excess_byte, view_one,
+	                                view_two);
+
+	/* Of the blocks that differ, tell those whose bytes were moved. */
+	if (chunks != NULL)
+		moved_blocks(chunks, block_cache, total_blocks,
+		             bytes_per_block, blocks_with_excess_byte);
 
 	return block_cache;
 }
@@ -270,42 +321,15 @@ static char *generate_blocks(struct file *file_one, struct file *file_two,
    ##            BLOCK OFFSET FUNCTIONS FOR OVERVIEW MODE             ##
    ##################################################################### */
 
-static unsigned long *generate_offsets(unsigned long *offset_index,
-                                       int total_blocks,
-                                       unsigned long bytes_per_block,
-                                       int blocks_with_excess_byte)
-{
-	int i;
-	unsigned long offset = 0;
-
-	/* De-allocate existing memory that holds the offset data. */
-	if (offset_index != NULL) free(offset_index);
-
-	/* Allocate the correct amount of memory and initialize it. */
-	offset_index = malloc(total_blocks * sizeof(unsigned long));
-	memset(offset_index, 0, total_blocks);
-
-	/* Generate offset data. */
-	for (i = 0; i < total_blocks; i++) {
-		offset_index[i] = offset;
-		if (i < blocks_with_excess_byte) {
-			offset += bytes_per_block + 1;
-		} else {
-			offset += bytes_per_block;
-		}
-	}
-
-	return offset_index;
-}
-
-static unsigned long calculate_offset(unsigned long file_offset,
-                                      unsigned long *offset_index, int width,
-                                      int total_blocks, int shift_type,
-                                      unsigned long largest_file_size)
+static hex_offset calculate_offset(hex_offset file_offset,
+                                   hex_offset bytes_per_block,
+                                   int blocks_with_excess_byte, int width,
+                                   int total_blocks, int shift_type,
+                                   hex_offset largest_file_size)
 {
 
 	/* Initialize variables. */
-	unsigned long new_offset = file_offset;
+	hex_offset new_offset = file_offset;
 	int blocks_in_row = width - SIDE_MARGIN*2;
 	int current_block = 0;
 
@@ -316,7 +340,8 @@ static unsigned long calculate_offset(unsigned long file_offset,
 
 	/* Locate the current block we're in. */
 	current_block = calculate_current_block(total_blocks, file_offset,
-	                                        offset_index);
+	                                        bytes_per_block,
+	                                        blocks_with_excess_byte);
 
 	/* Return the offset of the block we want. */
 	switch (shift_type) {
@@ -355,7 +380,8 @@ static unsigned long calculate_offset(unsigned long file_offset,
 			}
 	}
 
-	new_offset = offset_index[current_block];
+	new_offset = block_offset(current_block, bytes_per_block,
+	                          blocks_with_excess_byte);
 	return new_offset;
 }
 
@@ -373,11 +399,199 @@ static char *getfilename(char *f) {
 	return(res);
 }
 
+/* #####################################################################
+   ##                 CACHING THE BYTES ON SCREEN                     ##
+   ##################################################################### */
+
+/* The bytes of both files shown in the hex rows. Each file is read with
+   a single call for the whole viewport, into a ring of rows: scrolling
+   by a few lines moves the top of the ring and only reads the rows that
+   come into view. Meanwhile, a prefetcher reads the screens around it,
+   so that those reads seldom have to wait for the disk. */
+struct viewport {
+	struct file_view *views[2];  /* Where the bytes are read from     */
+	struct prefetch *prefetch;   /* Reads ahead of the view, or NULL  */
+	unsigned char *data[2];      /* Ring of rows of each file         */
+	unsigned long *lengths[2];   /* Bytes read in each of those rows  */
+	hex_offset start;            /* File offset of the top row        */
+	hex_offset second;           /* Offset of file two in that row    */
+	int rows;                    /* Rows on screen                    */
+	int row_size;                /* Bytes in each row                 */
+	int top;                     /* Ring row holding the top row      */
+	int loaded;                  /* The ring holds the rows of start  */
+	unsigned long rows_shown;    /* Rows brought into view so far     */
+	unsigned long rows_read;     /* Those that had to be read         */
+	struct diff_map *signed_map; /* Map against a signature, or NULL  */
+};
+
+static void init_viewport(struct viewport *viewport,
+                          struct file_view *view_one,
+                          struct file_view *view_two,
+                          struct prefetch *prefetch)
+{
+	viewport->views[0] = view_one;
+	viewport->views[1] = view_two;
+	viewport->prefetch = prefetch;
+	viewport->data[0] = viewport->data[1] = NULL;
+	viewport->lengths[0] = viewport->lengths[1] = NULL;
+	viewport->rows = viewport->row_size = 0;
+	viewport->top = 0;
+	viewport->loaded = 0;
+	viewport->rows_shown = viewport->rows_read = 0;
+	viewport->signed_map = NULL;
+}
+
+static void free_viewport(struct viewport *viewport)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		free(viewport->data[i]);
+		free(viewport->lengths[i]);
+		viewport->data[i] = NULL;
+		viewport->lengths[i] = NULL;
+	}
+	viewport->rows = viewport->row_size = 0;
+	viewport->loaded = 0;
+}
+
+/* Reads count rows of both files, from the given row of the screen on,
+   into consecutive rows of the ring starting at ring_row. */
+static void read_rows(struct viewport *viewport, int row, int ring_row,
+                      int count)
+{
+	hex_offset offset;
+	unsigned long size = (unsigned long) viewport->row_size;
+	unsigned long bytes_read, *lengths;
+	int i, j;
+
+	for (i = 0; i < 2; i++) {
+		offset = ((i == 0) ? viewport->start : viewport->second) +
+		         (hex_offset) row * viewport->row_size;
+		advise_file(viewport->views[i]->file, offset,
+		            (hex_offset) count * size, ADVISE_WILLNEED);
+		bytes_read = copy_view(viewport->views[i], offset,
+		                       viewport->data[i] + ring_row * size,
+		                       count * size);
+		lengths = viewport->lengths[i] + ring_row;
+		for (j = 0; j < count; j++) {
+			if (bytes_read >= (j + 1) * size) lengths[j] = size;
+			else if (bytes_read > j * size)
+				lengths[j] = bytes_read - j * size;
+			else lengths[j] = 0;
+		}
+	}
+}
+
+/* Reads count rows of the screen from the given one on, wherever they
+   fall in the ring. */
+static void load_rows(struct viewport *viewport, int row, int count)
+{
+	int ring_row = (viewport->top + row) % viewport->rows;
+	int before_wrap = viewport->rows - ring_row;
+
+	if (count <= before_wrap) {
+		read_rows(viewport, row, ring_row, count);
+	} else {
+		read_rows(viewport, row, ring_row, before_wrap);
+		read_rows(viewport, row + before_wrap, 0, count - before_wrap);
+	}
+}
+
+/* Makes the viewport hold rows rows of row_size bytes from offset on in
+   file one, and from second on in file two. When the new rows overlap the
+   ones held, only the missing rows are read. */
+static void update_viewport(struct viewport *viewport, hex_offset offset,
+                            hex_offset second, int rows, int row_size)
+{
+	hex_offset shift = 0;
+	int i, down = 0, direction = 0;
+
+	/* Start over whenever the shape of the viewport changes. */
+	if (rows != viewport->rows || row_size != viewport->row_size) {
+		free_viewport(viewport);
+		if (rows <= 0 || row_size <= 0) return;
+		for (i = 0; i < 2; i++) {
+			viewport->data[i] = malloc((unsigned long) rows *
+			                           row_size);
+			viewport->lengths[i] = malloc(sizeof(unsigned long) *
+			                              rows);
+		}
+		viewport->rows = rows;
+		viewport->row_size = row_size;
+		if (viewport->data[0] == NULL || viewport->data[1] == NULL ||
+		    viewport->lengths[0] == NULL ||
+		    viewport->lengths[1] == NULL) {
+			free_viewport(viewport);
+			return;
+		}
+	}
+
+	if (viewport->loaded && offset == viewport->start &&
+	    second == viewport->second) return;
+
+	/* See whether the new offset is a whole number of rows away, with
+	   the files lined up as before. */
+	if (viewport->loaded &&
+	    second - offset == viewport->second - viewport->start) {
+		if (offset > viewport->start) {
+			shift = offset - viewport->start;
+			down = 1;
+			direction = 1;
+		} else {
+			shift = viewport->start - offset;
+			direction = -1;
+		}
+		if (shift % row_size != 0 ||
+		    shift / row_size >= (hex_offset) rows)
+			shift = 0;
+		else shift /= row_size;
+	}
+
+	viewport->start = offset;
+	viewport->second = second;
+	viewport->loaded = 1;
+	viewport->rows_shown += rows;
+	viewport->rows_read += (shift == 0) ? (unsigned long) rows : shift;
+
+	if (shift == 0) {
+		viewport->top = 0;
+		load_rows(viewport, 0, rows);
+	} else if (down) {
+		viewport->top = (viewport->top + (int) shift) % rows;
+		load_rows(viewport, rows - (int) shift, (int) shift);
+	} else {
+		viewport->top = (viewport->top + rows - (int) shift) % rows;
+		load_rows(viewport, 0, (int) shift);
+	}
+
+	/* Read on in the direction the view moves. */
+	request_prefetch(viewport->prefetch, offset,
+	                 (unsigned long) rows * row_size, direction);
+}
+
+/* Returns the bytes of both files at the given row and column of the
+   viewport through byte_one and byte_two. *present_one and *present_two
+   tell whether each file has such a byte. */
+static void viewport_bytes(struct viewport *viewport, int row, int column,
+                           unsigned char *byte_one, int *present_one,
+                           unsigned char *byte_two, int *present_two)
+{
+	int ring_row = (viewport->top + row) % viewport->rows;
+	unsigned long at = (unsigned long) ring_row * viewport->row_size +
+	                   column;
+
+	*present_one = (unsigned long) column < viewport->lengths[0][ring_row];
+	*present_two = (unsigned long) column < viewport->lengths[1][ring_row];
+	*byte_one = *present_one ? viewport->data[0][at] : 0;
+	*byte_two = *present_two ? viewport->data[1][at] : 0;
+}
+
 /* #####################################################################
    ##           DRAW ROWS OF RAW DATA IN HEX/ASCII FORM               ##
    ##################################################################### */
 
-static void display_file_names(int row, struct file *file_one,
+static void display_file_names(WINDOW *window, struct file *file_one,
                                struct file *file_two, int offset_char_size,
                                int offset_jump)
 {
@@ -388,139 +602,272 @@ static void display_file_names(int row, struct file *file_one,
 	filename_two = getfilename(file_two->name);
 
 	/* Display the file names. */
-	attron(COLOR_PAIR(TITLE_BAR));
-	mvprintw(row, SIDE_MARGIN+offset_char_size+3, " %s   ",
-	        filename_one);
-	mvprintw(row, SIDE_MARGIN+offset_char_size+4+
-	        offset_jump*2, " %s   ", filename_two);
-	attroff(COLOR_PAIR(TITLE_BAR));
+	wattron(window, COLOR_PAIR(TITLE_BAR));
+	mvwprintw(window, 0, SIDE_MARGIN+offset_char_size+3, " %s   ",
+	          filename_one);
+	mvwprintw(window, 0, SIDE_MARGIN+offset_char_size+4+
+	          offset_jump*2, " %s   ", filename_two);
+	wattroff(window, COLOR_PAIR(TITLE_BAR));
 }
 
-static void display_offsets(int start_row, int finish_row, int offset_jump,
-                            int offset_char_size, unsigned long file_offset)
+static void display_offsets(WINDOW *window, int rows, int offset_jump,
+                            int offset_char_size, hex_offset file_offset)
 {
 	int i;
-	char offset_line[32];
-	unsigned long temp_offset = file_offset;
-
-	attron(COLOR_PAIR(TITLE_BAR));
-	for (i = start_row; i < finish_row; i++) {
-		sprintf(offset_line, "0x%%0%ix ", offset_char_size);
-		mvprintw(i, SIDE_MARGIN, offset_line, temp_offset);
+	char offset_line[OFFSET_DIGITS];
+	hex_offset temp_offset = file_offset;
+
+	wattron(window, COLOR_PAIR(TITLE_BAR));
+	for (i = 0; i < rows; i++) {
+		mvwprintw(window, i, SIDE_MARGIN, "0x%s ",
+		          format_offset(offset_line, temp_offset, 16,
+		                        offset_char_size));
 		temp_offset += offset_jump - 1;
 	}
-	attroff(COLOR_PAIR(TITLE_BAR));
+	wattroff(window, COLOR_PAIR(TITLE_BAR));
+}
+
+/* The two characters each byte is shown as, in either display. They are
+   looked up rather than formatted for every byte on screen. */
+static char byte_glyphs[2][256][2];
+
+static void init_byte_glyphs(void)
+{
+	static const char digits[] = "0123456789abcdef";
+	int byte;
+
+	for (byte = 0; byte < 256; byte++) {
+		byte_glyphs[HEX_VIEW][byte][0] = ' ';
+		byte_glyphs[HEX_VIEW][byte][1] = raw_to_ascii(byte);
+		byte_glyphs[ASCII_VIEW][byte][0] = digits[byte >> 4];
+		byte_glyphs[ASCII_VIEW][byte][1] = digits[byte & 15];
+	}
+}
+
+/* Fills the two cells showing a byte in the given colour. */
+static void set_byte_cells(chtype *cells, unsigned char byte, int colour,
+                           chtype bold, int display)
+{
+	chtype attributes = COLOR_PAIR(colour) | bold;
+
+	if (colour == BLOCK_EMPTY) {
+		cells[0] = cells[1] = ' ' | attributes;
+	} else {
+		cells[0] = (unsigned char) byte_glyphs[display][byte][0] |
+		           attributes;
+		cells[1] = (unsigned char) byte_glyphs[display][byte][1] |
+		           attributes;
+	}
 }
 
-static void draw_hex_data(int start_row, int finish_row, struct file *file_one,
-                          struct file *file_two, unsigned long file_offset,
-                          int offset_char_size, int offset_jump, int display)
+/* Colour of the byte of file one at the given row and column of the
+   viewport, when it is checked against a signature: that only tells
+   whether the chunk the byte lies in differs. */
+static int signed_colour(struct viewport *viewport, int row, int column)
 {
+	struct diff_map *map = viewport->signed_map;
+	hex_offset offset = viewport->start +
+	                    (hex_offset) row * viewport->row_size + column;
+	unsigned long chunk = (unsigned long) (offset / DIFF_CHUNK_SIZE);
+
+	if (!map->complete && !map->batch_done[chunk / DIFF_BATCH_CHUNKS])
+		return BLOCK_PENDING;
+	return chunk_differs(map, chunk) ? BLOCK_DIFFERENT : BLOCK_SAME;
+}
 
-	unsigned long temp_offset = file_offset;
+static void draw_hex_data(WINDOW *window, int rows,
+                          struct viewport *viewport, hex_offset file_offset,
+                          hex_offset second_offset, int offset_char_size,
+                          int offset_jump, int display)
+{
+	/* Each row is composed in a buffer of cells, file one's bytes then
+	   file two's, and written out in a single call. */
+	int first_column = SIDE_MARGIN + offset_char_size + 3;
+	int second_pane = offset_jump * 2 + 1;
+	int row_size = offset_jump - 1;
+	int length = second_pane + row_size * 2;
+	chtype *cells = malloc(sizeof(chtype) * length);
 	int i, j;
 
-	for (i = start_row; i < finish_row; i++) {
-		int bold = 0;
-		for (j = SIDE_MARGIN+offset_char_size+3; j <
-			SIDE_MARGIN+offset_char_size+offset_jump*2+1; j += 2) {
-			int colour_pair;
-			unsigned char byte_one, byte_two;
-			char byte_one_hex[16], byte_two_hex[16];
-			char byte_one_ascii, byte_two_ascii;
-			int bytes_read_one, bytes_read_two;
-
-			/* Seek to the proper locations in the file. */
-			fseek(file_one->pointer, temp_offset, SEEK_SET);
-			fseek(file_two->pointer, temp_offset, SEEK_SET);
-
-			/* Read a byte from the files. */
-			bytes_read_one = fread(&byte_one, 1, 1, file_one->pointer);
-			bytes_read_two = fread(&byte_two, 1, 1, file_two->pointer);
-
-			/* Convert binary to ASCII hex. */
-			sprintf(byte_one_hex, "%02x", byte_one);
-			sprintf(byte_two_hex, "%02x", byte_two);
-			byte_one_hex[2] = '\0';
-			byte_two_hex[2] = '\0';
-
-			/* Interpret ASCII version of bytes. */
-			byte_one_ascii = raw_to_ascii(byte_one);
-			byte_two_ascii = raw_to_ascii(byte_two);
+	if (cells == NULL) return;
+
+	/* Bring the bytes of the rows on screen in, reading only those
+	   that were not there already. */
+	update_viewport(viewport, file_offset, second_offset, rows, row_size);
+
+	/* Blank out the space between the two files. */
+	for (j = row_size * 2; j < second_pane; j++) cells[j] = ' ';
+
+	for (i = 0; i < rows; i++) {
+		for (j = 0; j < row_size; j++) {
+			int colour_one, colour_two;
+			unsigned char byte_one = 0, byte_two = 0;
+			int bytes_read_one = 0, bytes_read_two = 0;
 
 			/* Make every other byte bold. */
-			if (bold != 0) attron(A_BOLD);
+			chtype bold = (j & 1) ? A_BOLD : 0;
 
-			/* Post results. */
+			/* Get the bytes of the files. */
+			if (viewport->rows > 0)
+				viewport_bytes(viewport, i, j, &byte_one,
+				               &bytes_read_one, &byte_two,
+				               &bytes_read_two);
 
-			/* Byte 1:
-			   Determine if its EMPTY/DIFFERENT/SAME. */
+			/* Determine if each is EMPTY/DIFFERENT/SAME. */
 			if (bytes_read_one == 0) {
-				colour_pair = BLOCK_EMPTY;
+				colour_one = BLOCK_EMPTY;
+				colour_two = BLOCK_DIFFERENT;
 			} else if (bytes_read_two == 0) {
-				colour_pair = BLOCK_DIFFERENT;
+				colour_one = BLOCK_DIFFERENT;
+				colour_two = BLOCK_EMPTY;
 			} else if (byte_one == byte_two) {
-				colour_pair = BLOCK_SAME;
-			} else {
-				colour_pair = BLOCK_DIFFERENT;
-			}
-
-			/* Display the block. */
-			attron(COLOR_PAIR(colour_pair));
-			if (colour_pair == BLOCK_EMPTY) {
-				mvprintw(i,j, "  ");
-			} else if (display == HEX_VIEW) {
-				mvprintw(i,j, " %c", byte_one_ascii);
+				colour_one = colour_two = BLOCK_SAME;
 			} else {
-				mvprintw(i,j, "%s", byte_one_hex);
+				colour_one = colour_two = BLOCK_DIFFERENT;
 			}
-			attroff(COLOR_PAIR(colour_pair));
-
-			/* Byte 2:
-			   Determine if its EMPTY/DIFFERENT/SAME. */
-			if (bytes_read_two == 0) {
-				colour_pair = BLOCK_EMPTY;
-			} else if (bytes_read_one == 0) {
-				colour_pair = BLOCK_DIFFERENT;
-			} else if (byte_one == byte_two) {
-				colour_pair = BLOCK_SAME;
-			} else {
-				colour_pair = BLOCK_DIFFERENT;
+			if (bytes_read_one == 0 && bytes_read_two == 0)
+				colour_two = BLOCK_EMPTY;
+
+			/* A signature has no bytes to show. */
+			if (viewport->signed_map != NULL) {
+				colour_two = BLOCK_EMPTY;
+				if (bytes_read_one)
+					colour_one = signed_colour(viewport, i,
+					                           j);
 			}
 
-			/* Display the block. */
-			attron(COLOR_PAIR(colour_pair));
-			if (colour_pair == BLOCK_EMPTY) {
-				mvprintw(i,j+offset_jump*2+1, "  ");
-			} else if (display == HEX_VIEW) {
-				mvprintw(i,j+offset_jump*2+1, " %c", byte_two_ascii);
-			} else {
-				mvprintw(i,j+offset_jump*2+1, "%s", byte_two_hex);
-			}
-			attroff(COLOR_PAIR(colour_pair));
+			set_byte_cells(cells + j * 2, byte_one, colour_one,
+			               bold, display);
+			set_byte_cells(cells + second_pane + j * 2, byte_two,
+			               colour_two, bold, display);
+		}
+		mvwaddchnstr(window, i, first_column, cells, length);
+	}
 
-			/* Switch bold characters with non-bold characters. */
-			if (bold != 0) attroff(A_BOLD);
-			bold ^= 1;
+	free(cells);
+}
 
-			temp_offset++;
+/* Colours of the cells of file one and file two for each kind of edit,
+   from EDIT_SAME on. */
+static const int edit_colours[4][2] = {
+	{ BLOCK_SAME, BLOCK_SAME },
+	{ BLOCK_DIFFERENT, BLOCK_DIFFERENT },
+	{ BLOCK_DIFFERENT, BLOCK_EMPTY },
+	{ BLOCK_EMPTY, BLOCK_DIFFERENT }
+};
+
+/* Draws the rows from file_offset on as the diff has them: bytes deleted
+   from file one face a blank in file two, and bytes inserted in file two
+   a blank in file one, so that the bytes on either side of them line up.
+   Each row is labelled with the offset in file one it starts at. */
+static void draw_diff_data(WINDOW *window, int rows, struct byte_diff *diff,
+                           hex_offset file_offset, int offset_char_size,
+                           int offset_jump, int display)
+{
+	int first_column = SIDE_MARGIN + offset_char_size + 3;
+	int second_pane = offset_jump * 2 + 1;
+	int row_size = offset_jump - 1;
+	int length = second_pane + row_size * 2;
+	chtype *cells = malloc(sizeof(chtype) * length);
+	char offset_line[OFFSET_DIGITS];
+	struct edit_cursor cursor;
+	int i, j;
+
+	if (cells == NULL) return;
+	seek_edit(diff, file_offset, &cursor);
+
+	/* Blank out the space between the two files. */
+	for (j = row_size * 2; j < second_pane; j++) cells[j] = ' ';
+
+	for (i = 0; i < rows; i++) {
+		wattron(window, COLOR_PAIR(TITLE_BAR));
+		mvwprintw(window, i, SIDE_MARGIN, "0x%s ",
+		          format_offset(offset_line,
+		                        edit_offset(diff, &cursor), 16,
+		                        offset_char_size));
+		wattroff(window, COLOR_PAIR(TITLE_BAR));
+
+		for (j = 0; j < row_size; j++) {
+			unsigned char byte_one = 0, byte_two = 0;
+			int colour_one = BLOCK_EMPTY, colour_two = BLOCK_EMPTY;
+			int edit = next_edit(diff, &cursor, &byte_one,
+			                     &byte_two);
+			chtype bold = (j & 1) ? A_BOLD : 0;
+
+			if (edit != EDIT_END) {
+				colour_one = edit_colours[edit][0];
+				colour_two = edit_colours[edit][1];
+			}
+			set_byte_cells(cells + j * 2, byte_one, colour_one,
+			               bold, display);
+			set_byte_cells(cells + second_pane + j * 2, byte_two,
+			               colour_two, bold, display);
 		}
+		mvwaddchnstr(window, i, first_column, cells, length);
 	}
 
-	return;
+	free(cells);
 }
 
 /* #####################################################################
-   ##              GENERATE SCREEN IN OVERVIEW MODE                   ##
+   ##                    LAYING OUT THE SCREEN                        ##
    ##################################################################### */
 
-static void generate_overview(struct file *file_one, struct file *file_two,
-                              unsigned long *file_offset, int width,
-                              int height, char *block_cache, int total_blocks,
-                              unsigned long *offset_index, int display,
-                              unsigned long largest_file_size)
+/* The screen is split into windows that are drawn and refreshed on their
+   own. Each keypress only redraws what it changed: moving the cursor
+   over the overview repaints two blocks, and a scan running in the
+   background repaints the title bar and the blocks it got to. What each
+   window shows is remembered to tell what changed. */
+struct screen {
+	WINDOW *title;               /* Top row: files, offset and scan   */
+	WINDOW *overview;            /* Block diagram, in overview mode   */
+	WINDOW *names;               /* File names above the hex rows     */
+	WINDOW *hex;                 /* Offsets and bytes of both files   */
+	WINDOW *menu;                /* Bottom row: keys                  */
+	WINDOW *hud;                 /* Performance overlay, if shown     */
+	char mode;                   /* Mode the windows are laid out for */
+	int width, height;           /* Size they are laid out for        */
+	int hex_rows;                /* Rows of the hex window            */
+	char *blocks;                /* Blocks shown in the overview      */
+	int total_blocks;            /* Number of those                   */
+	int cell_blocks;             /* Blocks shown in each cell         */
+	int active_block;            /* Block shown as active, or -1      */
+	hex_offset file_offset;      /* Offset shown by the hex rows      */
+	hex_offset second_offset;    /* Offset of file two in those rows  */
+	int display;                 /* HEX_VIEW or ASCII_VIEW shown      */
+	int menu_keys;               /* MENU_* keys the menu lists        */
+	char scan_status[64];        /* Scan progress shown in the title  */
+	char job_status[64];         /* Job progress shown in the menu    */
+	int drawn;                   /* The windows show a whole screen   */
+};
+
+static void init_screen(struct screen *screen)
+{
+	screen->title = screen->overview = NULL;
+	screen->names = screen->hex = screen->menu = NULL;
+	screen->hud = NULL;
+	screen->blocks = NULL;
+	screen->total_blocks = 0;
+	screen->drawn = 0;
+}
+
+static void free_screen(struct screen *screen)
 {
+	if (screen->title != NULL) delwin(screen->title);
+	if (screen->overview != NULL) delwin(screen->overview);
+	if (screen->names != NULL) delwin(screen->names);
+	if (screen->hex != NULL) delwin(screen->hex);
+	if (screen->menu != NULL) delwin(screen->menu);
+	if (screen->hud != NULL) delwin(screen->hud);
+	free(screen->blocks);
+	init_screen(screen);
+}
 
+/* Creates the windows for the mode and the size of the terminal. Nothing
+   is shown in them yet. */
+static void layout_screen(struct screen *screen, char mode, int width,
+                          int height, int total_blocks, int hud)
+{
 	/* In overview mode:
 
 	   BLOCKDIAGRAM-BLOCKDIAGRAM-BLOCKDIAGRAM-BLOCKDIAGRAM
@@ -535,150 +882,494 @@ static void generate_overview(struct file *file_one, struct file *file_two,
 
 	   Where BLOCKDIAGRAM is the blue/red squares comparing
 	   hex blocks from file 1 and file 2. Size is variable.
-	   SCROLLBAR is the scrollbar representing how far in
-	   the file we are, HEX1 is the hex for file 1 from the
-	   offset, and HEX2 is the hex for file 2 from the
-	   offset. */
+	   HEX1 is the hex for file 1 from the offset, and HEX2
+	   is the hex for file 2 from the offset.
 
-	/* Create variables. */
-	int i, j;
-	int offset_char_size;
-	int hex_width;
-	int offset_jump;
-	int current_block;
+	   In hex mode, the file names are at the top, and the
+	   hex rows take up the rest of the screen. */
 
-	/* Define colors block diagram. */
-	init_pair(BLOCK_SAME,      COLOR_WHITE, COLOR_BLUE);
-	init_pair(BLOCK_DIFFERENT, COLOR_WHITE, COLOR_RED);
-	init_pair(BLOCK_EMPTY,     COLOR_BLACK, COLOR_CYAN);
-	init_pair(BLOCK_ACTIVE,    COLOR_BLACK, COLOR_YELLOW);
-	init_pair(TITLE_BAR,       COLOR_BLACK, COLOR_WHITE);
+	free_screen(screen);
 
-	/* Find which block in the diagram is active based off of
-	   the current offset. */
+	screen->title = newwin(1, width, 0, 0);
+	screen->menu = newwin(1, width, height - 1, 0);
+	if (mode == OVERVIEW_MODE) {
+		screen->overview = newwin(height - VERTICAL_BLACK_SPACE,
+		                          width - SIDE_MARGIN*2, 2,
+		                          SIDE_MARGIN);
+		screen->names = newwin(1, width, height - 8, 0);
+		screen->hex_rows = 5;
+		screen->hex = newwin(screen->hex_rows, width, height - 7, 0);
+	} else {
+		screen->names = newwin(1, width, 2, 0);
+		screen->hex_rows = height - 5;
+		screen->hex = newwin(screen->hex_rows, width, 3, 0);
+	}
 
-	/* Generate the block diagram. */
-	for (i = 0; i < height - VERTICAL_BLACK_SPACE; i++) {
-		for (j = 0; j < width - SIDE_MARGIN*2; j++) {
+	/* The performance overlay goes over the top right corner. */
+	if (hud) {
+		int hud_width = (width > HUD_WIDTH) ? HUD_WIDTH : width;
+		screen->hud = newwin(HUD_HEIGHT, hud_width, 1,
+		                     width - hud_width);
+	}
 
-			/* Draw the blocks that are matching/different/empty. */
-			int index = i*(width-SIDE_MARGIN*2)+j;
-			attron(COLOR_PAIR(block_cache[index]));
-			mvprintw(i+2,j+SIDE_MARGIN," ");
-			attroff(COLOR_PAIR(block_cache[index]));
+	/* No block is shown yet: none of them matches the blocks. */
+	screen->blocks = malloc(total_blocks);
+	memset(screen->blocks, 0, total_blocks);
+	screen->total_blocks = total_blocks;
+	screen->cell_blocks = total_blocks / (width - SIDE_MARGIN*2) /
+	                      (height - VERTICAL_BLACK_SPACE);
+	screen->active_block = -1;
+
+	screen->mode = mode;
+	screen->width = width;
+	screen->height = height;
+
+	/* Blank out what lies between the windows. */
+	werase(stdscr);
+	wnoutrefresh(stdscr);
+}
+
+/* #####################################################################
+   ##              GENERATE SCREEN IN OVERVIEW MODE                   ##
+   ##################################################################### */
+
+/* The cell showing a block. Blocks the scan hasn't reached yet are
+   dotted. */
+static chtype block_cell(char colour)
+{
+	return ((colour == BLOCK_PENDING) ? '.' : ' ') | COLOR_PAIR(colour);
+}
+
+/* Backgrounds of the shades of differing blocks, with 8 and with 256
+   colours. The basic colours only make for two of them. */
+static const short heat_colours[2][HEAT_LEVELS] = {
+	{ COLOR_MAGENTA, COLOR_MAGENTA, COLOR_RED, COLOR_RED },
+	{ 224, 217, 203, 196 }
+};
+
+#ifdef HEX_UNICODE
+/* The cell showing two blocks, one above the other: an upper half block
+   in the colour of the top one, over the colour of the bottom one.
+   Blocks the scan hasn't reached yet are plain black. */
+static void set_half_cell(cchar_t *cell, char top, char bottom)
+{
+	static const wchar_t upper_half[] = { 0x2580, 0 };
+
+	setcchar(cell, upper_half, A_NORMAL, HALF_PAIR(top, bottom), NULL);
+}
+#endif
+
+/* Tells whether the overview can show two blocks per cell. This takes
+   ncursesw, a UTF-8 terminal, and a colour pair for any two blocks. */
+static int half_blocks_available(void)
+{
+#ifdef HEX_UNICODE
+	return (strcmp(nl_langinfo(CODESET), "UTF-8") == 0 &&
+	        COLOR_PAIRS > HALF_PAIR(BLOCK_COLOURS, BLOCK_COLOURS));
+#else
+	return 0;
+#endif
+}
+
+/* Defines the pairs drawing a block over another, from the backgrounds
+   of the pairs of single blocks. */
+static void init_half_pairs(void)
+{
+	short foreground, backgrounds[BLOCK_COLOURS + 1];
+	int top, bottom;
+
+	for (top = 1; top <= BLOCK_COLOURS; top++)
+		pair_content(top, &foreground, &backgrounds[top]);
+	for (top = 1; top <= BLOCK_COLOURS; top++)
+		for (bottom = 1; bottom <= BLOCK_COLOURS; bottom++)
+			init_pair(HALF_PAIR(top, bottom), backgrounds[top],
+			          backgrounds[bottom]);
+}
+
+static void draw_block(struct screen *screen, int block, char colour)
+{
+	int columns = screen->width - SIDE_MARGIN*2;
+	int row = block / columns;
+
+#ifdef HEX_UNICODE
+	/* The block shares its cell with the one above or below it. */
+	if (screen->cell_blocks == 2) {
+		cchar_t cell;
+
+		if (row % 2 == 0)
+			set_half_cell(&cell, colour,
+			              screen->blocks[block + columns]);
+		else
+			set_half_cell(&cell, screen->blocks[block - columns],
+			              colour);
+		mvwadd_wch(screen->overview, row / 2, block % columns, &cell);
+		return;
+	}
+#endif
+
+	mvwaddch(screen->overview, row, block % columns, block_cell(colour));
+}
+
+/* Draws the rows of blocks that are not shown as they are in
+   block_cache, each with a single call, and moves the active block.
+   Returns whether anything was drawn. */
+static int generate_overview(struct screen *screen, char *block_cache,
+                             int current_block)
+{
+	int columns = screen->width - SIDE_MARGIN*2;
+	int span = columns * screen->cell_blocks;
+	int rows = screen->total_blocks / span;
+	chtype *cells = malloc(sizeof(chtype) * columns);
+#ifdef HEX_UNICODE
+	cchar_t *half_cells = malloc(sizeof(cchar_t) * columns);
+#endif
+	int i, j, drawn = 0;
+
+	if (cells == NULL) return 0;
+
+	/* Draw the blocks that are matching/different/empty. Each row of
+	   cells shows span blocks. */
+	for (i = 0; i < rows; i++) {
+		char *blocks = block_cache + i * span;
+		char *shown = screen->blocks + i * span;
+
+		if (memcmp(blocks, shown, span) == 0) continue;
+		memcpy(shown, blocks, span);
+#ifdef HEX_UNICODE
+		if (screen->cell_blocks == 2 && half_cells != NULL) {
+			for (j = 0; j < columns; j++)
+				set_half_cell(&half_cells[j], blocks[j],
+				              blocks[j + columns]);
+			mvwadd_wchnstr(screen->overview, i, 0, half_cells,
+			               columns);
+		} else
+#endif
+		{
+			for (j = 0; j < columns; j++)
+				cells[j] = block_cell(blocks[j]);
+			mvwaddchnstr(screen->overview, i, 0, cells, columns);
 		}
+		drawn = 1;
+
+		/* The row was drawn over the active block. */
+		if (current_block / span == i &&
+		    current_block == screen->active_block)
+			draw_block(screen, current_block, BLOCK_ACTIVE);
 	}
+	free(cells);
+#ifdef HEX_UNICODE
+	free(half_cells);
+#endif
 
 	/* Show the active block. */
-	current_block = calculate_current_block(total_blocks, *file_offset, offset_index);
-	attron(COLOR_PAIR(BLOCK_ACTIVE));
-	mvprintw(current_block / (width - SIDE_MARGIN*2) + 2,
-	         current_block % (width - SIDE_MARGIN*2) + SIDE_MARGIN," ");
-	attroff(COLOR_PAIR(BLOCK_ACTIVE));
-
-	/* Generate the offset markers.
-	   Calculate parameters for the offset. */
+	if (current_block != screen->active_block) {
+		if (screen->active_block >= 0)
+			draw_block(screen, screen->active_block,
+			           screen->blocks[screen->active_block]);
+		draw_block(screen, current_block, BLOCK_ACTIVE);
+		screen->active_block = current_block;
+		drawn = 1;
+	}
+
+	return drawn;
+}
+
+/* #####################################################################
+   ##                 GENERATE SCREEN IN HEX MODE                     ##
+   ##################################################################### */
+
+static void generate_hex(struct screen *screen, struct viewport *viewport,
+                         hex_offset file_offset, hex_offset second_offset,
+                         struct byte_diff *diff, int display,
+                         int offset_char_size, int offset_jump)
+{
+	werase(screen->hex);
+
+	/* Show the edits between the files where they were worked out. */
+	if (diff != NULL && diff->complete) {
+		draw_diff_data(screen->hex, screen->hex_rows, diff,
+		               file_offset, offset_char_size, offset_jump,
+		               display);
+		return;
+	}
+
+	/* Display the hex offsets on the left. */
+	display_offsets(screen->hex, screen->hex_rows, offset_jump,
+	                offset_char_size, file_offset);
+
+	/* Generate HEX characters. */
+	draw_hex_data(screen->hex, screen->hex_rows, viewport, file_offset,
+	              second_offset, offset_char_size, offset_jump, display);
+}
+
+/* #####################################################################
+   ##                    PERFORMANCE OVERLAY                          ##
+   ##################################################################### */
+
+/* What the overlay toggled with 'i' goes by. It shows how long the last
+   frame took to draw and to send to the terminal, what the display read
+   meanwhile, how fast the scan went, how often the hex rows were on
+   screen already and how much memory is in use, so that slow storage
+   can be told from a slow terminal. */
+struct hud {
+	int shown;                   /* The overlay is on                 */
+	double draw_seconds;         /* Composing the last frame          */
+	double output_seconds;       /* Sending it to the terminal        */
+	unsigned long reads;         /* Reads made by the views so far    */
+	hex_offset bytes_read;       /* Bytes they read so far            */
+	struct scan_progress *scan;  /* Progress of the scan, or NULL     */
+};
+
+static void generate_hud(WINDOW *window, struct hud *hud,
+                         struct viewport *viewport)
+{
+	struct file_view *view_one = viewport->views[0];
+	struct file_view *view_two = viewport->views[1];
+	unsigned long reads = view_one->reads + view_two->reads;
+	hex_offset bytes_read = view_one->bytes_read + view_two->bytes_read;
+	hex_offset resident = resident_memory();
+	struct scan_progress *scan = hud->scan;
+
+	werase(window);
+	wattron(window, COLOR_PAIR(TITLE_BAR));
+	box(window, 0, 0);
+	mvwprintw(window, 0, 2, " Performance ");
+	wattroff(window, COLOR_PAIR(TITLE_BAR));
+
+	mvwprintw(window, 1, 2, "Frame  %.2f ms drawing, %.2f ms output",
+	          hud->draw_seconds * 1000, hud->output_seconds * 1000);
+	mvwprintw(window, 2, 2, "Reads  %lu calls, %.1f KiB", reads -
+	          hud->reads, (double) (bytes_read - hud->bytes_read) / 1024);
+
+	if (scan == NULL) {
+		mvwprintw(window, 3, 2, "Scan   loaded from the index");
+	} else if (scan->seconds > 0) {
+		mvwprintw(window, 3, 2, "Scan   %.1f MiB/s%s",
+		          scan->bytes_done / scan->seconds / (1024 * 1024),
+		          scan->finished ? "" : ", running");
+	} else {
+		mvwprintw(window, 3, 2, "Scan   starting");
+	}
+
+	if (viewport->rows_shown > 0) {
+		mvwprintw(window, 4, 2, "Rows   %lu%% on screen already",
+		          100 - viewport->rows_read * 100 /
+		          viewport->rows_shown);
+	} else {
+		mvwprintw(window, 4, 2, "Rows   none shown yet");
+	}
+
+	if (resident > 0) {
+		mvwprintw(window, 5, 2, "Memory %.1f MiB resident",
+		          (double) resident / (1024 * 1024));
+	} else {
+		mvwprintw(window, 5, 2, "Memory unknown");
+	}
+
+	hud->reads = reads;
+	hud->bytes_read = bytes_read;
+}
+
+/* #####################################################################
+   ##                    GENERATE SCREEN VIEW                         ##
+   ##################################################################### */
+
+static void generate_screen(struct screen *screen, struct file *file_one,
+                            struct file *file_two,
+                            struct viewport *viewport, char mode,
+                            hex_offset *file_offset, int width,
+                            int height, char *block_cache, int total_blocks,
+                            hex_offset bytes_per_block,
+                            int blocks_with_excess_byte, int display,
+                            hex_offset largest_file_size,
+                            struct alignment *alignment,
+                            struct byte_diff *diff,
+                            struct scan_progress *progress,
+                            const char *job_status, struct hud *hud)
+{
+	char scan_status[64];
+	int whole, offset_char_size, hex_width, offset_jump;
+	double start_time = current_time(), drawn_time;
+	hex_offset second_offset = *file_offset;
+
+	/* Aligned, both files scroll together from the offsets that line
+	   up at the top row. */
+	if (alignment != NULL)
+		second_offset = aligned_offset(alignment, *file_offset);
+
+	/* Start over with new windows if the layout changed. */
+	whole = (!screen->drawn || mode != screen->mode ||
+	         width != screen->width || height != screen->height ||
+	         total_blocks != screen->total_blocks);
+	if (whole)
+		layout_screen(screen, mode, width, height, total_blocks,
+		              hud->shown);
+
+	/* Calculate parameters for the offset. */
 	offset_char_size = calculate_max_offset_characters(largest_file_size);
 	hex_width = width - offset_char_size - 3 - SIDE_MARGIN * 2;
 	offset_jump = (hex_width - (hex_width % 4)) / 4;
 
-	/* Display the offsets.
-	   Display the hex offsets on the left. */
-	display_offsets(height-7, height-2, offset_jump, offset_char_size,
-	                *file_offset);
+	/* The title bar shows the offset, and how far the scan got. */
+	scan_status[0] = 0;
+	if (progress != NULL && !progress->finished)
+		format_scan_status(scan_status, progress);
+	if (whole || *file_offset != screen->file_offset ||
+	    second_offset != screen->second_offset ||
+	    strcmp(scan_status, screen->scan_status) != 0) {
+		generate_titlebar(screen->title, file_one, file_two,
+		                  *file_offset, second_offset, width,
+		                  scan_status);
+		wnoutrefresh(screen->title);
+	}
 
-	/* Generate HEX characters
-	   Seek to initial offset. */
-	draw_hex_data(height - 7, height - 2, file_one, file_two,
-	              *file_offset, offset_char_size, offset_jump, display);
+	if (whole || display != screen->display ||
+	    strcmp(job_status, screen->job_status) != 0) {
+		generate_menu(screen->menu, width, mode, display,
+		              screen->menu_keys, job_status);
+		wnoutrefresh(screen->menu);
+	}
 
-	/* Write the file titles. */
-	display_file_names(height-8, file_one, file_two, offset_char_size,
-	                   offset_jump);
+	if (mode == OVERVIEW_MODE &&
+	    generate_overview(screen, block_cache,
+	                      calculate_current_block(total_blocks,
+	                      *file_offset, bytes_per_block,
+	                      blocks_with_excess_byte)))
+		wnoutrefresh(screen->overview);
+
+	if (whole) {
+		display_file_names(screen->names, file_one, file_two,
+		                   offset_char_size, offset_jump);
+		wnoutrefresh(screen->names);
+	}
 
-	return;
+	if (whole || *file_offset != screen->file_offset ||
+	    second_offset != screen->second_offset ||
+	    display != screen->display) {
+		generate_hex(screen, viewport, *file_offset, second_offset,
+		             diff, display, offset_char_size, offset_jump);
+		wnoutrefresh(screen->hex);
+	}
+
+	screen->file_offset = *file_offset;
+	screen->second_offset = second_offset;
+	screen->display = display;
+	strcpy(screen->scan_status, scan_status);
+	strcpy(screen->job_status, job_status);
+	screen->drawn = 1;
+	drawn_time = current_time();
+
+	/* The overlay goes over whatever was redrawn under it. */
+	if (screen->hud != NULL) {
+		generate_hud(screen->hud, hud, viewport);
+		touchwin(screen->hud);
+		wnoutrefresh(screen->hud);
+	}
+
+	/* Send all the changes to the terminal at once. */
+	doupdate();
+
+	hud->draw_seconds = drawn_time - start_time;
+	hud->output_seconds = current_time() - drawn_time;
 }
 
 /* #####################################################################
-   ##                 GENERATE SCREEN IN HEX MODE                     ##
+   ##                 KEEPING TRACK OF THE SCAN                       ##
    ##################################################################### */
 
-static void generate_hex(struct file *file_one, struct file *file_two,
-                         unsigned long *file_offset, int width, int height,
-                         int display, unsigned long largest_file_size)
+/* Checks on the scan that builds the overview. Returns the progress to
+   show in the title bar, or NULL once the scan is over. While it runs,
+   keypresses are waited for with a timeout, so that the overview keeps
+   filling in when the user is idle. Once it is over, the map is saved
+   for the next time these files are compared. */
+static struct scan_progress *check_scan(struct scan **scan,
+                                        struct scan_progress *progress,
+                                        WINDOW *window,
+                                        struct diff_map *map,
+                                        struct file *file_one,
+                                        struct file *file_two,
+                                        struct options *options)
 {
+	if (*scan == NULL) return NULL;
+
+	if (poll_scan(*scan, progress)) {
+		stop_scan(*scan);
+		*scan = NULL;
+		if (options->use_index) save_index(map, file_one, file_two);
+		wtimeout(window, -1);
+		return NULL;
+	}
 
-	/* In hex mode:
+	/* A scan without worker threads only advances when polled. */
+	wtimeout(window, scan_in_background(*scan) ? SCAN_REFRESH_DELAY : 0);
+	return progress;
+}
 
-	          FILENAME 1               FILENAME 2
-	   OFFSET HEX1-HEX1-HEX1-HEX1-HEX1 HEX2-HEX2-HEX2-HEX2
-	   OFFSET HEX1-HEX1-HEX1-HEX1-HEX1 HEX2-HEX2-HEX2-HEX2
-	   OFFSET HEX1-HEX1-HEX1-HEX1-HEX1 HEX2-HEX2-HEX2-HEX2
-	   OFFSET HEX1-HEX1-HEX1-HEX1-HEX1 HEX2-HEX2-HEX2-HEX2
-	   OFFSET HEX1-HEX1-HEX1-HEX1-HEX1 HEX2-HEX2-HEX2-HEX2
-	   OFFSET HEX1-HEX1-HEX1-HEX1-HEX1 HEX2-HEX2-HEX2-HEX2
-	   OFFSET HEX1-HEX1-HEX1-HEX1-HEX1 HEX2-HEX2-HEX2-HEX2
-	   OFFSET HEX1-HEX1-HEX1-HEX1-HEX1 HEX2-HEX2-HEX2-HEX2
-	   OFFSET HEX1-HEX1-HEX1-HEX1-HEX1 HEX2-HEX2-HEX2-HEX2
-	*/
+/* What the jobs started by the display work on. */
+struct job_files {
+	struct file *file_one, *file_two;
+	int threads;
+};
 
-	/* Generate the offset markers.
-	   Calculate parameters for the offset. */
-	int offset_char_size = calculate_max_offset_characters(largest_file_size);
-	int hex_width = width - offset_char_size - 3 - SIDE_MARGIN * 2;
-	int offset_jump = (hex_width - (hex_width % 4)) / 4;
+static void *align_work(struct job *job, void *argument)
+{
+	struct job_files *files = argument;
 
-	/* Define colors block diagram. */
-	init_pair(BLOCK_SAME,      COLOR_WHITE, COLOR_BLUE);
-	init_pair(BLOCK_DIFFERENT, COLOR_WHITE, COLOR_RED);
-	init_pair(BLOCK_EMPTY,     COLOR_BLACK, COLOR_CYAN);
-	init_pair(BLOCK_ACTIVE,    COLOR_BLACK, COLOR_YELLOW);
-	init_pair(TITLE_BAR,       COLOR_BLACK, COLOR_WHITE);
+	return align_files(files->file_one, files->file_two, job);
+}
 
-	/* Display the hex offsets on the left. */
-	display_offsets(3, height-2, offset_jump, offset_char_size,
-	                *file_offset);
+static void *chunk_work(struct job *job, void *argument)
+{
+	struct job_files *files = argument;
+
+	return chunk_files(files->file_one, files->file_two, files->threads,
+	                   job);
+}
 
-	/* Generate HEX characters
-	   Seek to initial offset. */
-	draw_hex_data(3, height - 2, file_one, file_two,
-	              *file_offset, offset_char_size, offset_jump, display);
+/* Checks on a job started by the display. Returns 1 once it is over,
+   with what it came up with in *result. While it runs, its progress is
+   added to status under the given name. */
+static int check_job(struct job **job, void **result, const char *name,
+                     char *status)
+{
+	struct scan_progress progress;
 
+	if (*job == NULL) return 0;
 
-	/* Write the file titles. */
-	display_file_names(2, file_one, file_two, offset_char_size,
-	                   offset_jump);
+	if (poll_job(*job, &progress)) {
+		*result = stop_job(*job);
+		*job = NULL;
+		return 1;
+	}
 
-	return;
+	format_job_status(status, name, &progress);
+	return 0;
 }
 
 /* #####################################################################
-   ##                    GENERATE SCREEN VIEW                         ##
+   ##                  DIFFING AROUND THE HEX VIEW                    ##
    ##################################################################### */
 
-static void generate_screen(struct file *file_one, struct file *file_two,
-                            char mode, unsigned long *file_offset, int width,
-                            int height, char *block_cache, int total_blocks,
-                            unsigned long *offset_index, int display,
-                            unsigned long largest_file_size)
+/* Keeps the byte diff shown by the hex view up with the offset, working
+   it out again from there once it no longer covers it. A beep tells when
+   the files differ too much around the offset for it to be worked out,
+   and the bytes are shown at the same offsets instead. */
+static struct byte_diff *follow_diff(struct byte_diff *diff,
+                                     struct file_view *view_one,
+                                     struct file_view *view_two,
+                                     hex_offset file_offset,
+                                     struct alignment *alignment)
 {
-	/* Clear the window. */
-	erase();
+	hex_offset second_offset = file_offset;
 
-	/* Generate the title bar. */
-	generate_titlebar(file_one, file_two, *file_offset, width, height,
-		          mode, display);
+	if (diff != NULL && diff_covers(diff, file_offset)) return diff;
+	free_byte_diff(diff);
 
-	/* Generate the window contents according to the mode we're in. */
-	if (mode == OVERVIEW_MODE) {
-		generate_overview(file_one, file_two, file_offset,
-		                  width, height, block_cache, total_blocks,
-		                  offset_index, display, largest_file_size);
-
-	} else if (mode == HEX_MODE) {
-		generate_hex(file_one, file_two, file_offset, width, height,
-		             display, largest_file_size);
-	}
+	if (alignment != NULL)
+		second_offset = aligned_offset(alignment, file_offset);
+	diff = diff_window(view_one, view_two, file_offset, second_offset);
+	if (diff == NULL || !diff->complete) beep();
+	return diff;
 }
 
 /* #####################################################################
@@ -686,22 +1377,53 @@ static void generate_screen(struct file *file_one, struct file *file_two,
    ##################################################################### */
 
 void start_gui(struct file *file_one, struct file *file_two,
-               unsigned long largest_file_size)
+               hex_offset largest_file_size, struct options *options)
 {
 	/* Initiate variables */
-	unsigned long file_offset = 0;      /* File offset. */
+	hex_offset file_offset = 0;         /* File offset. */
 	char mode = OVERVIEW_MODE;          /* Display mode. */
 	int key_pressed;                    /* What key is pressed. */
 	char *block_cache = NULL;           /* A quick comparison overview. */
-	unsigned long *offset_index = NULL; /* Keep track of offsets per block. */
 	int display = HEX_VIEW;             /* ASCII vs. HEX mode. */
 	MEVENT mouse;                       /* Mouse event struct. */
+	struct file_view view_one, view_two; /* Hex view access to files. */
+	struct viewport viewport;           /* Bytes shown in the hex view. */
+	struct prefetch *prefetch;          /* Reads ahead of the view. */
+	struct screen screen;               /* Windows and what they show. */
+	struct hud hud;                     /* Performance overlay. */
+	struct diff_map *map;               /* Differences between the files. */
+	struct diff_map *previous;          /* Map from before a change. */
+	int unchanged = 0;                  /* File that did not change. */
+	hex_offset *known_one, *known_two;  /* Prints known of each file. */
+	struct scan *scan;                  /* Scan building the map. */
+	struct scan_progress progress;      /* How far along the scan is. */
+	struct scan_progress *status;       /* Progress shown, if scanning. */
+	struct job_files job_files;         /* What the jobs work on. */
+	struct job *align_job = NULL;       /* Job lining the files up. */
+	struct job *chunk_job = NULL;       /* Job looking for moves. */
+	char job_status[64];                /* Progress of the jobs. */
+	void *result;                       /* What a job came up with. */
+	struct alignment *alignment = NULL; /* How the files line up. */
+	struct alignment *followed = NULL;  /* Same, while it is followed. */
+	struct chunk_map *chunks = NULL;    /* Bytes found in either file. */
+	int chunk_side = 0;                 /* File 'c' jumps from. */
+	struct byte_diff *byte_diff = NULL; /* Edits around the hex view. */
+	int diffing = 0;                    /* The hex view shows them. */
+	int pending_blocks;                 /* Blocks not known yet. */
+	int queued_keys = 0;                /* Keys handled since drawing. */
+	int resized = 0;                    /* The terminal was resized. */
 	WINDOW *main_window;                /* Pointer for main window. */
 
-	int width, height, total_blocks, blocks_with_excess_byte;
-	unsigned long bytes_per_block;
+	int width, height, total_blocks, blocks_with_excess_byte, i;
+	int cell_blocks = 1;                /* Overview blocks per cell. */
+	int half_blocks;                    /* Cells can show two blocks. */
+	int found;                          /* A difference was jumped to. */
+	hex_offset bytes_per_block;
 
 	/* Initiate the display. */
+#ifdef HEX_UNICODE
+	setlocale(LC_CTYPE, ""); /* Draw in the encoding of the terminal. */
+#endif
 	main_window = initscr(); /* Start curses mode. */
 	if (has_colors() != TRUE) {
 		puts("Error: Your terminal do not seem to handle colors.");
@@ -715,33 +1437,129 @@ void start_gui(struct file *file_one, struct file *file_two,
 	curs_set(0);             /* Make the cursor invisible. */
 	mousemask(ALL_MOUSE_EVENTS, NULL); /* Get all mouse events. */
 	clear();                 /* Clear out the screen */
+	refresh();
+
+	/* Define colors. */
+	init_pair(BLOCK_SAME,      COLOR_WHITE, COLOR_BLUE);
+	init_pair(BLOCK_DIFFERENT, COLOR_WHITE, COLOR_RED);
+	init_pair(BLOCK_EMPTY,     COLOR_BLACK, COLOR_CYAN);
+	init_pair(BLOCK_ACTIVE,    COLOR_BLACK, COLOR_YELLOW);
+	init_pair(TITLE_BAR,       COLOR_BLACK, COLOR_WHITE);
+	init_pair(BLOCK_PENDING,   COLOR_WHITE, COLOR_BLACK);
+	init_pair(BLOCK_MOVED,     COLOR_WHITE, COLOR_GREEN);
+	for (i = 0; i < HEAT_LEVELS; i++)
+		init_pair(BLOCK_HEAT + i, COLOR_WHITE,
+		          heat_colours[COLORS >= 256][i]);
+	half_blocks = half_blocks_available();
+	if (half_blocks) {
+		init_half_pairs();
+		cell_blocks = 2;
+	}
+	init_byte_glyphs();
+	init_screen(&screen);
+	screen.menu_keys = MENU_DIFF | MENU_INFO;
+	if (half_blocks) screen.menu_keys |= MENU_CELLS;
+	if (alignment != NULL) screen.menu_keys |= MENU_ALIGN;
+	if (chunks != NULL) screen.menu_keys |= MENU_MOVES;
+	hud.shown = 0;
+	hud.draw_seconds = hud.output_seconds = 0;
+	hud.reads = 0;
+	hud.bytes_read = 0;
 
 	/* Calculate values based on window dimensions. */
 	calculate_dimensions(&width, &height, &total_blocks, &bytes_per_block,
-                            largest_file_size, &blocks_with_excess_byte);
-
-	/* Compile the block/offset cache. The block cache contains an index
-	   of what the general differences are between the two compared
-	   files. It exists to avoid re-comparing the two files every time
-	   the screen is regenerated. The offset cache keeps track of what
-	   the offsets are for each block in the block diagram, as they
-	   may be uneven. */
-
-	block_cache = generate_blocks(file_one, file_two, block_cache,
-	                              total_blocks, bytes_per_block,
-	                              blocks_with_excess_byte);
-	offset_index = generate_offsets(offset_index, total_blocks,
-	                          bytes_per_block, blocks_with_excess_byte);
+                            largest_file_size, &blocks_with_excess_byte,
+                            cell_blocks);
+
+	/* The hex view reads the files at random offsets. Against a
+	   signature, file two is closed and empty: its view opens nothing,
+	   and only file one is read ahead. */
+	init_view(&view_one, file_one, HEX_VIEW_SIZE, ADVISE_RANDOM);
+	init_view(&view_two, file_two, HEX_VIEW_SIZE, ADVISE_RANDOM);
+	prefetch = start_prefetch(file_one,
+	                          (options->signature == NULL) ? file_two
+	                          : NULL, largest_file_size);
+	init_viewport(&viewport, &view_one, &view_two, prefetch);
+
+	/* Compare the files in the background. The scan fills in a map of
+	   which chunks of the files differ, which does not depend on the
+	   size of the window. If these files were compared before and have
+	   not changed since, the map is loaded from the index instead. If
+	   only one of them changed, the scan starts from the index, and
+	   only compares the chunks where that file changed. Otherwise,
+	   either of them may have been compared with a third file, whose
+	   index tells which of its chunks are the same without reading
+	   them. */
+	map = NULL;
+	scan = NULL;
+	previous = NULL;
+	known_one = NULL;
+	known_two = NULL;
+	if (options->use_index) {
+		map = load_index(file_one, file_two);
+		if (map == NULL)
+			previous = load_previous_index(file_one, file_two,
+			                               &unchanged);
+	}
+	if (map == NULL) {
+		map = new_diff_map(largest_file_size);
+		if (options->use_index && previous == NULL) {
+			known_one = load_prints(file_one, map->chunk_count);
+			known_two = load_prints(file_two, map->chunk_count);
+		}
+		scan = start_scan(file_one, file_two, map,
+		                  options->scan_memory, options->threads,
+		                  previous, unchanged, known_one, known_two,
+		                  options->signature);
+	}
+	if (options->signature != NULL) viewport.signed_map = map;
+	hud.scan = (scan != NULL) ? &progress : NULL;
+
+	/* Line the files up if asked to. This reads both of them through,
+	   so it is left to a job, next to the scan, and the alignment is
+	   followed once it is over. */
+	job_files.file_one = file_one;
+	job_files.file_two = file_two;
+	job_files.threads = options->threads;
+	if (options->align)
+		align_job = start_job(align_work, &job_files,
+		                      file_one->size + file_two->size);
+
+	/* Likewise, cut both files into chunks to find the data that was
+	   moved around, if asked to. */
+	if (options->moves)
+		chunk_job = start_job(chunk_work, &job_files,
+		                      file_one->size + file_two->size);
+	job_status[0] = 0;
+
+	/* Compile the block cache. The block cache contains an index of
+	   what the general differences are between the two compared files.
+	   It is derived from the difference map, and exists to avoid working
+	   it out every time the screen is regenerated. The offsets of the
+	   blocks follow from bytes_per_block and blocks_with_excess_byte,
+	   and are worked out when needed. */
+
+	block_cache = generate_blocks(map, block_cache, total_blocks,
+	                              bytes_per_block, blocks_with_excess_byte,
+	                              &view_one, &view_two, followed,
+	                              chunks, &pending_blocks);
 
 	/* Generate initial screen contents. */
-	generate_screen(file_one, file_two, mode, &file_offset, width, height,
-	                block_cache, total_blocks, offset_index, display,
-                        largest_file_size);
+	status = check_scan(&scan, &progress, main_window, map, file_one,
+	                    file_two, options);
+	if (scan == NULL && (align_job != NULL || chunk_job != NULL))
+		wtimeout(main_window, SCAN_REFRESH_DELAY);
+	generate_screen(&screen, file_one, file_two, &viewport, mode,
+	                &file_offset, width, height,
+	                block_cache, total_blocks, bytes_per_block,
+	                blocks_with_excess_byte, display, largest_file_size,
+	                followed, NULL, status, job_status, &hud);
 
 	/* Wait for user-keypresses and react accordingly. */
 	for(;;) {
 		/* poll the next keypress event from curses */
 		key_pressed = wgetch(main_window);
+		if (key_pressed != ERR) queued_keys++;
 
 		/* if we got 'q' or ESC, then quit */
 		if ((key_pressed == 'q') || (key_pressed == 27)) break;
@@ -753,43 +1571,59 @@ void start_gui(struct file *file_one, struct file *file_two,
 			case KEY_LEFT:
 				if (mode == OVERVIEW_MODE)
 				file_offset = calculate_offset(file_offset,
-				              offset_index, width, total_blocks,
+				              bytes_per_block,
+				              blocks_with_excess_byte, width,
+				              total_blocks,
 				              LEFT_BLOCK, largest_file_size);
 				break;
 			case KEY_RIGHT:
 				if (mode == OVERVIEW_MODE)
 				file_offset = calculate_offset(file_offset,
-				              offset_index, width, total_blocks,
+				              bytes_per_block,
+				              blocks_with_excess_byte, width,
+				              total_blocks,
 				              RIGHT_BLOCK, largest_file_size);
 				break;
 			case KEY_UP:
 				if (mode == OVERVIEW_MODE)
 				file_offset = calculate_offset(file_offset,
-				              offset_index, width, total_blocks,
+				              bytes_per_block,
+				              blocks_with_excess_byte, width,
+				              total_blocks,
 				              UP_ROW, largest_file_size);
 				else if (mode == HEX_MODE)
 				file_offset = calculate_offset(file_offset,
-				              offset_index, width, total_blocks,
+				              bytes_per_block,
+				              blocks_with_excess_byte, width,
+				              total_blocks,
 				              UP_LINE, largest_file_size);
 				break;
 			case KEY_DOWN:
 				if (mode == OVERVIEW_MODE)
 				file_offset = calculate_offset(file_offset,
-				              offset_index, width, total_blocks,
+				              bytes_per_block,
+				              blocks_with_excess_byte, width,
+				              total_blocks,
 				              DOWN_ROW, largest_file_size);
 				else if (mode == HEX_MODE)
 				file_offset = calculate_offset(file_offset,
-				              offset_index, width, total_blocks,
+				              bytes_per_block,
+				              blocks_with_excess_byte, width,
+				              total_blocks,
 				              DOWN_LINE, largest_file_size);
 				break;
 			case KEY_NPAGE:
 				file_offset = calculate_offset(file_offset,
-				              offset_index, width, total_blocks,
+				              bytes_per_block,
+				              blocks_with_excess_byte, width,
+				              total_blocks,
 				              DOWN_LINE, largest_file_size);
 				break;
 			case KEY_PPAGE:
 				file_offset = calculate_offset(file_offset,
-				              offset_index, width, total_blocks,
+				              bytes_per_block,
+				              blocks_with_excess_byte, width,
+				              total_blocks,
 				              UP_LINE, largest_file_size);
 				break;
 			case 'm':
@@ -800,49 +1634,220 @@ void start_gui(struct file *file_one, struct file *file_two,
 				if (mode == OVERVIEW_MODE) mode = HEX_MODE;
 				else mode = OVERVIEW_MODE;
 				break;
+
+			/* Switch between one and two blocks per cell of
+			   the overview, where the terminal can show two. The
+			   blocks are worked out again, as on a resize. */
+			case 'b':
+				if (!half_blocks) {
+					beep();
+					break;
+				}
+				cell_blocks = 3 - cell_blocks;
+				calculate_dimensions(&width, &height, &total_blocks,
+	                               &bytes_per_block, largest_file_size,
+	                               &blocks_with_excess_byte, cell_blocks);
+				resized = 1;
+				break;
+
+			/* Follow the alignment or the offsets, where the
+			   files were aligned. The blocks are worked out
+			   again, as on a resize. */
+			case 'a':
+				if (alignment == NULL) {
+					beep();
+					break;
+				}
+				if (followed == NULL) followed = alignment;
+				else followed = NULL;
+				free_byte_diff(byte_diff);
+				byte_diff = NULL;
+				resized = 1;
+				break;
+
+			/* Show the bytes inserted, deleted and changed
+			   around the hex view, or the bytes at the same
+			   offsets again. */
+			case 'd':
+				diffing = !diffing;
+				if (!diffing) {
+					free_byte_diff(byte_diff);
+					byte_diff = NULL;
+				}
+				screen.drawn = 0;
+				break;
+
+			/* Jump to where the bytes at the top row were
+			   moved to in file two, and from there back to file
+			   one. The jump is made from file two first if there
+			   is nowhere to go from file one. */
+			case 'c':
+				found = 0;
+				if (chunks != NULL && followed == NULL) {
+					found = counterpart(chunks, chunk_side,
+					                    file_offset,
+					                    &file_offset);
+					if (!found) {
+						chunk_side = !chunk_side;
+						found = counterpart(chunks,
+						        chunk_side, file_offset,
+						        &file_offset);
+					}
+				}
+				if (found) chunk_side = !chunk_side;
+				else beep();
+				break;
+
+			/* Show or hide the performance overlay. */
+			case 'i':
+				hud.shown = !hud.shown;
+				screen.drawn = 0;
+				break;
+
+			/* Jump to the next/previous run of differing
+			   bytes, or to the next/previous gap between the
+			   stretches the files have in common when aligned. */
+			case 'n':
+				found = (followed != NULL)
+				        ? next_gap(followed, file_offset,
+				                   &file_offset)
+				        : next_difference(map, file_offset,
+				                          &file_offset);
+				if (!found) beep();
+				break;
+			case 'p':
+				found = (followed != NULL)
+				        ? previous_gap(followed, file_offset,
+				                       &file_offset)
+				        : previous_difference(map, file_offset,
+				                              &file_offset);
+				if (!found) beep();
+				break;
 			case KEY_MOUSE:
 				if (nc_getmouse(&mouse) == OK) {
 
 					/* Left single-click. */
 					if (mouse.bstate & BUTTON1_CLICKED)
-						mouse_clicked(&file_offset, offset_index,
+						mouse_clicked(&file_offset, bytes_per_block,
+									 blocks_with_excess_byte,
 									 width, height, total_blocks, &mode,
-									 mouse.x, mouse.y, BUTTON1_CLICKED);
+									 mouse.x, mouse.y, BUTTON1_CLICKED,
+									 cell_blocks);
 
 					/* Left double-click. */
 					if (mouse.bstate & BUTTON1_DOUBLE_CLICKED)
-						mouse_clicked(&file_offset, offset_index,
+						mouse_clicked(&file_offset, bytes_per_block,
+								     blocks_with_excess_byte,
 								     width, height, total_blocks, &mode,
 								     mouse.x, mouse.y,
-								     BUTTON1_DOUBLE_CLICKED);
+								     BUTTON1_DOUBLE_CLICKED,
+								     cell_blocks);
 				}
 				break;
 
 
-			/* Redraw the window on resize. Recaltulate dimensions,
-			   and redo the block/offset cache. */
+			/* Redraw the window on resize. Recaltulate dimensions
+			   now, for the keys that follow, and redo the block
+			   cache from the map once the input is handled. */
 			case KEY_RESIZE:
 				calculate_dimensions(&width, &height, &total_blocks,
 	                               &bytes_per_block, largest_file_size,
-	                               &blocks_with_excess_byte);
-				block_cache = generate_blocks(file_one, file_two,
-				            block_cache, total_blocks, bytes_per_block,
-				            blocks_with_excess_byte);
-				offset_index = generate_offsets(offset_index,
-				               total_blocks, bytes_per_block,
-				               blocks_with_excess_byte);
+	                               &blocks_with_excess_byte, cell_blocks);
+				resized = 1;
+				break;
+
+			/* Nothing was pressed before the timeout: a scan is
+			   running, and only the overview needs updating. */
+			case ERR:
 				break;
 		}
 
-		generate_screen(file_one, file_two, mode, &file_offset, width,
+		/* Handle all the input that is waiting before drawing, so
+		   that a held key, a mouse drag or a burst of resizes is
+		   drawn once, as a single change, rather than once per
+		   event. */
+		if (key_pressed != ERR && queued_keys < KEY_BATCH) {
+			wtimeout(main_window, 0);
+			continue;
+		}
+		queued_keys = 0;
+		wtimeout(main_window, -1);
+
+		/* Follow the alignment, and show the moved data, once their
+		   jobs are over, working out the blocks again for them. A beep
+		   tells if there was not enough memory for either. */
+		job_status[0] = 0;
+		if (check_job(&align_job, &result, "Aligning", job_status)) {
+			alignment = followed = result;
+			if (alignment == NULL) beep();
+			else screen.menu_keys |= MENU_ALIGN;
+			free_byte_diff(byte_diff);
+			byte_diff = NULL;
+			resized = 1;
+		}
+		if (check_job(&chunk_job, &result, "Finding moves",
+		              job_status)) {
+			chunks = result;
+			if (chunks == NULL) beep();
+			else screen.menu_keys |= MENU_MOVES;
+			resized = 1;
+		}
+
+		if (resized) {
+			block_cache = generate_blocks(map, block_cache,
+			              total_blocks, bytes_per_block,
+			              blocks_with_excess_byte, &view_one,
+			              &view_two, followed, chunks,
+			              &pending_blocks);
+			screen.drawn = 0;
+			resized = 0;
+		}
+
+		/* Fill in the blocks the scan has got to since. */
+		status = check_scan(&scan, &progress, main_window, map,
+		                    file_one, file_two, options);
+		if (scan == NULL && (align_job != NULL || chunk_job != NULL))
+			wtimeout(main_window, SCAN_REFRESH_DELAY);
+		if (pending_blocks > 0) {
+			pending_blocks = derive_blocks(map, block_cache,
+			                 total_blocks, bytes_per_block,
+			                 blocks_with_excess_byte, &view_one,
+			                 &view_two);
+			if (chunks != NULL)
+				moved_blocks(chunks, block_cache, total_blocks,
+				             bytes_per_block,
+				             blocks_with_excess_byte);
+		}
+
+		if (diffing)
+			byte_diff = follow_diff(byte_diff, &view_one,
+			                        &view_two, file_offset,
+			                        followed);
+
+		generate_screen(&screen, file_one, file_two, &viewport,
+		                mode, &file_offset, width,
 	                        height, block_cache, total_blocks,
-                                offset_index, display, largest_file_size);
+		                bytes_per_block, blocks_with_excess_byte,
+		                display, largest_file_size, followed,
+		                byte_diff, status, job_status, &hud);
 	}
 
 	/* End curses mode and exit. */
+	free_screen(&screen);
 	clear();
 	refresh();
 	endwin();
+	stop_scan(scan);
+	free_diff_map(map);
+	free_alignment(stop_job(align_job));
+	free_alignment(alignment);
+	free_chunk_map(stop_job(chunk_job));
+	free_chunk_map(chunks);
+	free_byte_diff(byte_diff);
+	stop_prefetch(viewport.prefetch);
+	free_viewport(&viewport);
+	free_view(&view_one);
+	free_view(&view_two);
 	free(block_cache);
 	return;
 }
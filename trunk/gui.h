@@ -16,6 +16,12 @@
 #ifndef HEX_GUI
 #define HEX_GUI
 
+/* Built against ncursesw, the overview can show two blocks per cell on
+   UTF-8 terminals. */
+#if defined(HEX_UNICODE) && !defined(NCURSES_WIDECHAR)
+#define NCURSES_WIDECHAR 1
+#endif
+
 #include <curses.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,10 +38,32 @@
 #define BLOCK_EMPTY 3           /* Grey Box */
 #define BLOCK_ACTIVE 4          /* Green Box */
 #define TITLE_BAR 5             /* Black text on White Background */
+#define BLOCK_PENDING 6         /* Dotted Black Box, not scanned yet */
+#define BLOCK_HEAT 7            /* Pink to Red Boxes, by how much of */
+#define HEAT_LEVELS 4           /* the block differs (7 to 10)       */
+#define BLOCK_MOVED 11          /* Green Box, bytes found elsewhere  */
+#define BLOCK_COLOURS 11        /* Last of the pairs above           */
+
+/* Pair drawing a block over another in a cell, in their backgrounds. */
+#define HALF_PAIRS 16
+#define HALF_PAIR(top, bottom) \
+	(HALF_PAIRS + ((top) - 1) * BLOCK_COLOURS + (bottom) - 1)
 
 #define SIDE_MARGIN 2           /* Width of the side margins in chars */
 #define VERTICAL_BLACK_SPACE 11 /* Sum of padding from top to bottom */
 
+#define SCAN_REFRESH_DELAY 200  /* ms between redraws while scanning */
+#define KEY_BATCH 256           /* Most keys handled between redraws */
+
+#define HUD_WIDTH 46            /* Size of the performance overlay   */
+#define HUD_HEIGHT 7
+
+#define MENU_INFO 1             /* Keys listed in the menu as far as */
+#define MENU_CELLS 2            /* its width allows                  */
+#define MENU_ALIGN 4
+#define MENU_MOVES 8
+#define MENU_DIFF 16
+
 #define UP_ROW 2
 #define DOWN_ROW -2
 #define LEFT_BLOCK -1
@@ -49,6 +77,6 @@
 #endif
 
 void start_gui(struct file *file_one, struct file *file_two,
-               unsigned long largest_file_size);
+               hex_offset largest_file_size, struct options *options);
 
 #endif
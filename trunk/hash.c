@@ -0,0 +1,160 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <string.h>
+#include "hash.h"
+
+/* The primes and rotations of xxHash, for the width of a word. */
+#if ULONG_MAX > 0xFFFFFFFFUL
+#define PRIME_1 0x9E3779B185EBCA87UL
+#define PRIME_2 0xC2B2AE3D27D4EB4FUL
+#define PRIME_3 0x165667B19E3779F9UL
+#define PRIME_4 0x85EBCA77C2B2AE63UL
+#define PRIME_5 0x27D4EB2F165667C5UL
+#define LANE_ROTATION 31
+#define WORD_ROTATION 27
+#else
+#define PRIME_1 0x9E3779B1UL
+#define PRIME_2 0x85EBCA77UL
+#define PRIME_3 0xC2B2AE3DUL
+#define PRIME_4 0x27D4EB2FUL
+#define PRIME_5 0x165667B1UL
+#define LANE_ROTATION 13
+#define WORD_ROTATION 17
+#endif
+
+#define WORD_SIZE sizeof(unsigned long)
+#define WORD_WIDTH (WORD_SIZE * CHAR_BIT)
+
+/* #####################################################################
+   ##                        MIXING WORDS                             ##
+   ##################################################################### */
+
+static unsigned long rotate(unsigned long word, int bits)
+{
+	return (word << bits) | (word >> (WORD_WIDTH - bits));
+}
+
+static unsigned long load_word(const unsigned char *data)
+{
+	unsigned long word;
+	memcpy(&word, data, WORD_SIZE);
+	return word;
+}
+
+static unsigned long mix_word(unsigned long lane, unsigned long word)
+{
+	lane += word * PRIME_2;
+	return rotate(lane, LANE_ROTATION) * PRIME_1;
+}
+
+/* Mixes whole stripes of data into the lanes. */
+static void mix_stripes(struct hash *hash, const unsigned char *data,
+                        unsigned long stripes)
+{
+	unsigned long lane_0 = hash->lanes[0], lane_1 = hash->lanes[1];
+	unsigned long lane_2 = hash->lanes[2], lane_3 = hash->lanes[3];
+
+	for (; stripes > 0; stripes--, data += HASH_STRIPE) {
+		lane_0 = mix_word(lane_0, load_word(data));
+		lane_1 = mix_word(lane_1, load_word(data + WORD_SIZE));
+		lane_2 = mix_word(lane_2, load_word(data + 2 * WORD_SIZE));
+		lane_3 = mix_word(lane_3, load_word(data + 3 * WORD_SIZE));
+	}
+
+	hash->lanes[0] = lane_0;
+	hash->lanes[1] = lane_1;
+	hash->lanes[2] = lane_2;
+	hash->lanes[3] = lane_3;
+}
+
+/* #####################################################################
+   ##                      HASHING A STREAM                           ##
+   ##################################################################### */
+
+void start_hash(struct hash *hash)
+{
+	hash->lanes[0] = PRIME_1 + PRIME_2;
+	hash->lanes[1] = PRIME_2;
+	hash->lanes[2] = 0;
+	hash->lanes[3] = 0 - PRIME_1;
+	hash->stripe_length = 0;
+	hash->length = 0;
+}
+
+void update_hash(struct hash *hash, const unsigned char *data,
+                 unsigned long length)
+{
+	unsigned long piece;
+
+	hash->length += length;
+
+	/* Complete the stripe left over from last time. */
+	if (hash->stripe_length > 0) {
+		piece = HASH_STRIPE - hash->stripe_length;
+		if (piece > length) piece = length;
+		memcpy(hash->stripe + hash->stripe_length, data, piece);
+		hash->stripe_length += piece;
+		data += piece;
+		length -= piece;
+		if (hash->stripe_length < HASH_STRIPE) return;
+		mix_stripes(hash, hash->stripe, 1);
+		hash->stripe_length = 0;
+	}
+
+	/* Mix the whole stripes straight from the data, and keep the rest
+	   for later. */
+	mix_stripes(hash, data, length / HASH_STRIPE);
+	piece = length % HASH_STRIPE;
+	memcpy(hash->stripe, data + length - piece, piece);
+	hash->stripe_length = piece;
+}
+
+unsigned long finish_hash(struct hash *hash)
+{
+	unsigned long result, i;
+
+	/* Fold the lanes together. */
+	if (hash->length >= HASH_STRIPE) {
+		result = rotate(hash->lanes[0], 1) +
+		         rotate(hash->lanes[1], 7) +
+		         rotate(hash->lanes[2], 12) +
+		         rotate(hash->lanes[3], 18);
+		for (i = 0; i < HASH_LANES; i++) {
+			result ^= mix_word(0, hash->lanes[i]);
+			result = result * PRIME_1 + PRIME_4;
+		}
+	} else result = PRIME_5;
+	result += hash->length;
+
+	/* Mix in what is left over, a word and then a byte at a time. */
+	for (i = 0; i + WORD_SIZE <= hash->stripe_length; i += WORD_SIZE) {
+		result ^= mix_word(0, load_word(hash->stripe + i));
+		result = rotate(result, WORD_ROTATION) * PRIME_1 + PRIME_4;
+	}
+	for (; i < hash->stripe_length; i++) {
+		result ^= hash->stripe[i] * PRIME_5;
+		result = rotate(result, 11) * PRIME_1;
+	}
+
+	/* Let every bit of the input affect every bit of the result. */
+	result ^= result >> (WORD_WIDTH / 2 + 1);
+	result *= PRIME_2;
+	result ^= result >> (WORD_WIDTH / 2 - 3);
+	result *= PRIME_3;
+	result ^= result >> (WORD_WIDTH / 2);
+	return result;
+}
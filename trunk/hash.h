@@ -0,0 +1,38 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEX_HASH
+#define HEX_HASH
+
+#define HASH_LANES 4
+#define HASH_STRIPE (HASH_LANES * sizeof(unsigned long))
+
+/* A fast, non-cryptographic hash of a stream of bytes, fed in pieces of
+   any size. It works a machine word at a time over four independent
+   lanes, in the manner of xxHash, so it keeps up with the comparison. The
+   result is as wide as an unsigned long. */
+struct hash {
+	unsigned long lanes[HASH_LANES];     /* Running state of each lane */
+	unsigned char stripe[HASH_STRIPE];   /* Bytes not yet mixed in     */
+	unsigned long stripe_length;         /* Number of such bytes       */
+	unsigned long length;                /* Bytes fed so far           */
+};
+
+void start_hash(struct hash *hash);
+void update_hash(struct hash *hash, const unsigned char *data,
+                 unsigned long length);
+unsigned long finish_hash(struct hash *hash);
+
+#endif
@@ -0,0 +1,454 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "index.h"
+#include "diffmap.h"
+#include "hash.h"
+
+#ifdef HEX_POSIX
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* The difference map of a pair of files is kept in a cache directory once
+   it is complete, so that opening the same pair again needs no scan. The
+   index is named after the device and inode of both files, and keyed
+   after their size and modification time as well: it is only trusted as
+   it is as long as neither of them was modified. Once one of them was,
+   the fingerprints of its chunks still tell which of them are as they
+   were, so that the scan only compares the others. As long as a file
+   is not modified, the fingerprints of its chunks also stand in for it
+   when it is compared with a third file. The index is laid out as
+   follows, in the word size and byte order of the machine that wrote
+   it:
+
+     header              struct index_header
+     prints of file one  chunk_count hex_offset, as in the map
+     prints of file two  chunk_count hex_offset, as in the map
+     bits                word_count words, as in the map
+     ranks               word_count + 1 words, as in the map
+     weights             word_count words, as in the map
+     ranges              range_count struct diff_range
+
+   It is mapped in as it is, and the map points straight into it. */
+
+/* What identifies the contents of a file, short of reading it. */
+struct index_key {
+	unsigned long device;       /* Device holding the file           */
+	unsigned long inode;        /* Its inode on that device          */
+	hex_offset size;            /* Its size                          */
+	unsigned long mtime;        /* Last modification, in seconds     */
+	unsigned long mtime_nsec;   /* ... and nanoseconds, if known     */
+};
+
+struct index_header {
+	char magic[8];              /* INDEX_MAGIC                       */
+	unsigned long version;      /* INDEX_VERSION                     */
+	unsigned long word_size;    /* sizeof(unsigned long)             */
+	unsigned long byte_order;   /* INDEX_BYTE_ORDER, as stored       */
+	unsigned long chunk_size;   /* DIFF_CHUNK_SIZE                   */
+	unsigned long batch_chunks; /* DIFF_BATCH_CHUNKS                 */
+	struct index_key keys[2];   /* The files the map was built from  */
+	hex_offset size;            /* Size of the largest one           */
+	unsigned long range_count;  /* Ranges of differences that follow */
+};
+
+#define INDEX_BYTE_ORDER 0x01020304UL
+
+#ifdef HEX_POSIX
+
+/* #####################################################################
+   ##                    LOCATING THE INDEX                           ##
+   ##################################################################### */
+
+static int get_key(struct file *file, struct index_key *key)
+{
+	struct stat status;
+
+	if (fstat(fileno(file->pointer), &status) != 0) return 1;
+	memset(key, 0, sizeof(struct index_key));
+	key->device = status.st_dev;
+	key->inode = status.st_ino;
+	key->size = file->size;
+	key->mtime = status.st_mtime;
+#ifdef __linux__
+	key->mtime_nsec = status.st_mtim.tv_nsec;
+#endif
+	return 0;
+}
+
+/* Works out where the indexes go: $XDG_CACHE_HOME/hexcompare/, or
+   ~/.cache/hexcompare/. Returns NULL if there is nowhere to put them. */
+static char *cache_directory(void)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *directory = "/hexcompare/";
+	char *path;
+
+	if (base == NULL || base[0] != '/') {
+		base = getenv("HOME");
+		directory = "/.cache/hexcompare/";
+		if (base == NULL || base[0] != '/') return NULL;
+	}
+
+	path = malloc(strlen(base) + strlen(directory) + 1);
+	sprintf(path, "%s%s", base, directory);
+	return path;
+}
+
+/* Works out where the index of a pair of files goes: in the cache
+   directory, in a file named after a hash of the device and inode of
+   both files, so that it is found again once either of them changed.
+   Returns NULL if there is nowhere to put it. */
+static char *index_path(struct index_key *keys)
+{
+	char *directory = cache_directory();
+	unsigned long identity[4];
+	struct hash hash;
+	char *path;
+
+	if (directory == NULL) return NULL;
+	identity[0] = keys[0].device;
+	identity[1] = keys[0].inode;
+	identity[2] = keys[1].device;
+	identity[3] = keys[1].inode;
+	start_hash(&hash);
+	update_hash(&hash, (const unsigned char *) identity,
+	            sizeof(identity));
+
+	path = malloc(strlen(directory) + 2 * sizeof(unsigned long) +
+	              sizeof(".idx"));
+	sprintf(path, "%s%0*lx.idx", directory,
+	        (int) (2 * sizeof(unsigned long)), finish_hash(&hash));
+	free(directory);
+	return path;
+}
+
+/* Creates the directories leading to path, as far as they are missing. */
+static void make_directories(char *path)
+{
+	char *slash;
+
+	for (slash = strchr(path + 1, '/'); slash != NULL;
+	     slash = strchr(slash + 1, '/')) {
+		*slash = 0;
+		if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+			*slash = '/';
+			return;
+		}
+		*slash = '/';
+	}
+}
+
+/* Size of the index of a map, header included. */
+static unsigned long index_size(struct diff_map *map)
+{
+	return sizeof(struct index_header) +
+	       sizeof(hex_offset) * 2 * map->chunk_count +
+	       sizeof(unsigned long) * (3 * map->word_count + 1) +
+	       sizeof(struct diff_range) * map->range_count;
+}
+
+static void fill_header(struct index_header *header, struct index_key *keys,
+                        hex_offset size, unsigned long range_count)
+{
+	memset(header, 0, sizeof(struct index_header));
+	memcpy(header->magic, INDEX_MAGIC, sizeof(header->magic));
+	header->version = INDEX_VERSION;
+	header->word_size = sizeof(unsigned long);
+	header->byte_order = INDEX_BYTE_ORDER;
+	header->chunk_size = DIFF_CHUNK_SIZE;
+	header->batch_chunks = DIFF_BATCH_CHUNKS;
+	memcpy(header->keys, keys, 2 * sizeof(struct index_key));
+	header->size = size;
+	header->range_count = range_count;
+}
+
+/* #####################################################################
+   ##                   LOADING AND SAVING                            ##
+   ##################################################################### */
+
+/* Maps in an index file, and returns the map it holds, complete and
+   ready for use. Returns NULL if it is not a usable index. */
+static struct diff_map *map_index_file(const char *path)
+{
+	struct index_header expected, *header;
+	struct diff_map *map;
+	struct stat status;
+	unsigned char *data;
+	int descriptor;
+
+	descriptor = open(path, O_RDONLY);
+	if (descriptor < 0) return NULL;
+
+	data = MAP_FAILED;
+	if (fstat(descriptor, &status) == 0 && (unsigned long) status.st_size
+	    >= sizeof(struct index_header))
+		data = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED,
+		            descriptor, 0);
+	close(descriptor);
+	if (data == MAP_FAILED) return NULL;
+
+	/* Work out the layout of the map the index was written for, and
+	   check the index against it. */
+	header = (struct index_header *) data;
+	map = malloc(sizeof(struct diff_map));
+	init_diff_map(map, header->size);
+	map->range_count = header->range_count;
+	fill_header(&expected, header->keys, header->size,
+	            header->range_count);
+	if (memcmp(data, &expected, sizeof(struct index_header)) != 0 ||
+	    (unsigned long) status.st_size != index_size(map)) {
+		munmap(data, status.st_size);
+		free(map);
+		return NULL;
+	}
+
+	/* The map is used straight from the index. */
+	map->index = data;
+	map->index_size = status.st_size;
+	map->prints_one = (hex_offset *) (data + sizeof(struct index_header));
+	map->prints_two = map->prints_one + map->chunk_count;
+	map->bits = (unsigned long *) (map->prints_two + map->chunk_count);
+	map->ranks = map->bits + map->word_count;
+	map->weights = map->ranks + map->word_count + 1;
+	map->ranges = (struct diff_range *) (map->weights +
+	                                     map->word_count);
+	map->complete = 1;
+	return map;
+}
+
+/* Maps in the index of a pair of files, whatever became of them since.
+   Bit i of *changed is set if file i + 1 is not as it was when the index
+   was written. Returns NULL if there is no usable index. */
+static struct diff_map *map_index(struct index_key *keys, int *changed)
+{
+	struct index_header *header;
+	struct diff_map *map;
+	char *path;
+	int i;
+
+	path = index_path(keys);
+	if (path == NULL) return NULL;
+	map = map_index_file(path);
+	free(path);
+	if (map == NULL) return NULL;
+
+	header = (struct index_header *) map->index;
+	*changed = 0;
+	for (i = 0; i < 2; i++)
+		if (memcmp(&keys[i], &header->keys[i],
+		           sizeof(struct index_key)) != 0)
+			*changed |= 1 << i;
+	return map;
+}
+
+/* Looks for the index of a pair of files, and returns the map it holds.
+   Returns NULL if there is none, or if it does not match the files as
+   they are now. */
+struct diff_map *load_index(struct file *file_one, struct file *file_two)
+{
+	struct index_key keys[2];
+	struct diff_map *map;
+	int changed;
+
+	if (get_key(file_one, &keys[0]) != 0 ||
+	    get_key(file_two, &keys[1]) != 0) return NULL;
+	map = map_index(keys, &changed);
+	if (map != NULL && changed != 0) {
+		free_diff_map(map);
+		return NULL;
+	}
+	return map;
+}
+
+/* Looks for the index of a pair of files of which only one was modified
+   since it was written, and returns the map it holds, for the scan to
+   start from. *unchanged is set to 0 if file one is the one that was not
+   modified, or to 1 for file two. Returns NULL if there is no such
+   index. */
+struct diff_map *load_previous_index(struct file *file_one,
+                                     struct file *file_two, int *unchanged)
+{
+	struct index_key keys[2];
+	struct diff_map *map;
+	int changed;
+
+	if (get_key(file_one, &keys[0]) != 0 ||
+	    get_key(file_two, &keys[1]) != 0) return NULL;
+	map = map_index(keys, &changed);
+	if (map == NULL) return NULL;
+	if (changed != 1 && changed != 2) {
+		free_diff_map(map);
+		return NULL;
+	}
+	*unchanged = (changed == 1);
+	return map;
+}
+
+/* Looks through the indexes of every pair of files for one that was
+   written from a file as it is now, paired with any other, and returns
+   the fingerprints of its chunks, for chunk_count chunks. Chunks the
+   file does not reach have the fingerprint of nothing, 0. Returns NULL
+   if there is no such index. */
+hex_offset *load_prints(struct file *file, unsigned long chunk_count)
+{
+	struct index_header *header;
+	struct index_key key;
+	struct dirent *entry;
+	struct diff_map *map;
+	hex_offset *prints = NULL, *found;
+	unsigned long count, length;
+	char *directory, *path;
+	DIR *listing;
+	int i;
+
+	if (get_key(file, &key) != 0) return NULL;
+	directory = cache_directory();
+	if (directory == NULL) return NULL;
+	listing = opendir(directory);
+	if (listing == NULL) {
+		free(directory);
+		return NULL;
+	}
+
+	while (prints == NULL && (entry = readdir(listing)) != NULL) {
+		length = strlen(entry->d_name);
+		if (length < 4 ||
+		    strcmp(entry->d_name + length - 4, ".idx") != 0) continue;
+		path = malloc(strlen(directory) + strlen(entry->d_name) + 1);
+		sprintf(path, "%s%s", directory, entry->d_name);
+		map = map_index_file(path);
+		free(path);
+		if (map == NULL) continue;
+
+		header = (struct index_header *) map->index;
+		for (i = 0; i < 2 && prints == NULL; i++) {
+			if (memcmp(&key, &header->keys[i],
+			           sizeof(struct index_key)) != 0) continue;
+			found = (i == 0) ? map->prints_one : map->prints_two;
+			count = (unsigned long) ((file->size + DIFF_CHUNK_SIZE
+			                          - 1) / DIFF_CHUNK_SIZE);
+			if (count > chunk_count) count = chunk_count;
+			prints = calloc(chunk_count + 1, sizeof(hex_offset));
+			memcpy(prints, found, sizeof(hex_offset) * count);
+		}
+		free_diff_map(map);
+	}
+
+	closedir(listing);
+	free(directory);
+	return prints;
+}
+
+/* Writes a complete map to the index of the files it was built from. A
+   temporary file is renamed into place, so that a session never sees an
+   index that is half written. Failures are ignored: the index is only a
+   cache. */
+void save_index(struct diff_map *map, struct file *file_one,
+                struct file *file_two)
+{
+	struct index_key keys[2];
+	struct index_header header;
+	char *path, *temporary;
+	FILE *output;
+	int failed;
+
+	if (!map->complete || map->index != NULL) return;
+	if (get_key(file_one, &keys[0]) != 0 ||
+	    get_key(file_two, &keys[1]) != 0) return;
+	path = index_path(keys);
+	if (path == NULL) return;
+	make_directories(path);
+
+	temporary = malloc(strlen(path) + 24);
+	sprintf(temporary, "%s.%ld", path, (long) getpid());
+	output = fopen(temporary, "wb");
+	if (output == NULL) {
+		free(temporary);
+		free(path);
+		return;
+	}
+
+	fill_header(&header, keys, map->size, map->range_count);
+	fwrite(&header, sizeof(struct index_header), 1, output);
+	fwrite(map->prints_one, sizeof(hex_offset), map->chunk_count, output);
+	fwrite(map->prints_two, sizeof(hex_offset), map->chunk_count, output);
+	fwrite(map->bits, sizeof(unsigned long), map->word_count, output);
+	fwrite(map->ranks, sizeof(unsigned long), map->word_count + 1,
+	       output);
+	fwrite(map->weights, sizeof(unsigned long), map->word_count, output);
+	fwrite(map->ranges, sizeof(struct diff_range), map->range_count,
+	       output);
+	failed = ferror(output);
+	if (fclose(output) != 0) failed = 1;
+
+	if (failed || rename(temporary, path) != 0) remove(temporary);
+	free(temporary);
+	free(path);
+}
+
+/* Releases the index a map was loaded from. */
+void unmap_index(struct diff_map *map)
+{
+	munmap(map->index, map->index_size);
+}
+
+#else
+
+/* The index is only kept on POSIX systems. */
+struct diff_map *load_index(struct file *file_one, struct file *file_two)
+{
+	(void) file_one;
+	(void) file_two;
+	return NULL;
+}
+
+struct diff_map *load_previous_index(struct file *file_one,
+                                     struct file *file_two, int *unchanged)
+{
+	(void) file_one;
+	(void) file_two;
+	(void) unchanged;
+	return NULL;
+}
+
+hex_offset *load_prints(struct file *file, unsigned long chunk_count)
+{
+	(void) file;
+	(void) chunk_count;
+	return NULL;
+}
+
+void save_index(struct diff_map *map, struct file *file_one,
+                struct file *file_two)
+{
+	(void) map;
+	(void) file_one;
+	(void) file_two;
+}
+
+void unmap_index(struct diff_map *map)
+{
+	(void) map;
+}
+
+#endif
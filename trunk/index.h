@@ -0,0 +1,33 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEX_INDEX
+#define HEX_INDEX
+
+#include "general.h"
+#include "diffmap.h"
+
+#define INDEX_MAGIC "HEXINDEX"  /* First bytes of an index file        */
+#define INDEX_VERSION 6UL       /* Bumped whenever the layout changes   */
+
+struct diff_map *load_index(struct file *file_one, struct file *file_two);
+struct diff_map *load_previous_index(struct file *file_one,
+                                     struct file *file_two, int *unchanged);
+hex_offset *load_prints(struct file *file, unsigned long chunk_count);
+void save_index(struct diff_map *map, struct file *file_one,
+                struct file *file_two);
+void unmap_index(struct diff_map *map);
+
+#endif
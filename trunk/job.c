@@ -0,0 +1,181 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include "job.h"
+#include "scan.h"
+
+#ifdef HEX_POSIX
+#include <pthread.h>
+#endif
+
+/* A job does a long piece of work, such as aligning the files, on a
+   thread of its own, so that the display comes up at once and keeps
+   answering while it runs, the way it does during the scan. The work
+   tells the job how many bytes it has gone through, and gives up when
+   the job asks it to. Where no thread can be started, the work is done
+   all at once, the first time the job is polled. */
+struct job {
+	job_work *work;
+	void *argument;
+	void *result;               /* What the work came up with       */
+	hex_offset bytes_done;      /* Bytes gone through so far        */
+	hex_offset bytes_total;     /* Bytes to go through in all       */
+	double start_time;          /* When the job was started         */
+	double finish_time;         /* When the work was over           */
+	int cancel;                 /* Asks the work to give up         */
+	int finished;               /* The work is over                 */
+	int threaded;               /* The work runs on a thread        */
+#ifdef HEX_POSIX
+	pthread_t thread;
+	pthread_mutex_t lock;       /* Protects the fields above        */
+#endif
+};
+
+/* #####################################################################
+   ##                      DOING THE WORK                             ##
+   ##################################################################### */
+
+static void lock_job(struct job *job)
+{
+#ifdef HEX_POSIX
+	pthread_mutex_lock(&job->lock);
+#else
+	(void) job;
+#endif
+}
+
+static void unlock_job(struct job *job)
+{
+#ifdef HEX_POSIX
+	pthread_mutex_unlock(&job->lock);
+#else
+	(void) job;
+#endif
+}
+
+static void run_job(struct job *job)
+{
+	void *result = job->work(job, job->argument);
+
+	lock_job(job);
+	job->result = result;
+	job->finished = 1;
+	job->finish_time = current_time();
+	unlock_job(job);
+}
+
+#ifdef HEX_POSIX
+static void *job_thread(void *argument)
+{
+	run_job(argument);
+	return NULL;
+}
+#endif
+
+/* Tells the job that its work went through so many more bytes. Returns
+   1 if the work is to give up, as the job is being stopped. Does
+   nothing for work done without a job. */
+int advance_job(struct job *job, hex_offset bytes)
+{
+	int cancel;
+
+	if (job == NULL) return 0;
+
+	lock_job(job);
+	job->bytes_done += bytes;
+	cancel = job->cancel;
+	unlock_job(job);
+	return cancel;
+}
+
+/* #####################################################################
+   ##                     RUNNING THE JOB                             ##
+   ##################################################################### */
+
+/* Starts doing the work on the argument, which goes through about
+   bytes_total bytes. Returns NULL if there is not enough memory. */
+struct job *start_job(job_work *work, void *argument,
+                      hex_offset bytes_total)
+{
+	struct job *job = malloc(sizeof(struct job));
+
+	if (job == NULL) return NULL;
+	job->work = work;
+	job->argument = argument;
+	job->result = NULL;
+	job->bytes_done = 0;
+	job->bytes_total = bytes_total;
+	job->start_time = current_time();
+	job->finish_time = job->start_time;
+	job->cancel = 0;
+	job->finished = 0;
+	job->threaded = 0;
+
+#ifdef HEX_POSIX
+	pthread_mutex_init(&job->lock, NULL);
+	job->threaded = (pthread_create(&job->thread, NULL, job_thread,
+	                                job) == 0);
+#endif
+
+	return job;
+}
+
+/* Fills in how far along the job is, if progress is not NULL. Returns 1
+   once the work is over. */
+int poll_job(struct job *job, struct scan_progress *progress)
+{
+	int finished;
+
+	/* Without a thread, do all of the work here. */
+	if (!job->threaded && !job->finished) run_job(job);
+
+	lock_job(job);
+	finished = job->finished;
+	if (progress != NULL) {
+		progress->bytes_done = job->bytes_done;
+		progress->bytes_total = job->bytes_total;
+		if (progress->bytes_done > progress->bytes_total)
+			progress->bytes_done = progress->bytes_total;
+		progress->seconds = (finished ? job->finish_time
+		                     : current_time()) - job->start_time;
+		progress->finished = finished;
+	}
+	unlock_job(job);
+
+	return finished;
+}
+
+/* Stops the job, asking the work to give up if it is not over, and
+   waiting for it to, and releases it. Returns what the work came up
+   with, which is only complete if poll_job() found the work over, or
+   NULL if it never started. */
+void *stop_job(struct job *job)
+{
+	void *result;
+
+	if (job == NULL) return NULL;
+
+	lock_job(job);
+	job->cancel = 1;
+	unlock_job(job);
+#ifdef HEX_POSIX
+	if (job->threaded) pthread_join(job->thread, NULL);
+	pthread_mutex_destroy(&job->lock);
+#endif
+	result = job->result;
+	free(job);
+	return result;
+}
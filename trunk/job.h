@@ -0,0 +1,34 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEX_JOB
+#define HEX_JOB
+
+#include "general.h"
+
+struct job;
+struct scan_progress;
+
+/* The work a job does. It is handed the job, to report how far it got
+   to, and its argument, and returns what it came up with. */
+typedef void *job_work(struct job *job, void *argument);
+
+struct job *start_job(job_work *work, void *argument,
+                      hex_offset bytes_total);
+int advance_job(struct job *job, hex_offset bytes);
+int poll_job(struct job *job, struct scan_progress *progress);
+void *stop_job(struct job *job);
+
+#endif
@@ -14,65 +14,266 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "general.h"
+#include "fileio.h"
+#include "compare.h"
+#include "fingerprint.h"
+#include "scan.h"
 #include "gui.h"
+#include "report.h"
+#include "signature.h"
 
 
+/* Parses the "--name" and "--name=value" options. Returns 0 on
+   success. */
+static int parse_option(char *arg, struct options *options)
+{
+	char *end;
+
+	if (strcmp(arg, "--no-index") == 0) {
+		options->use_index = 0;
+		return 0;
+	}
+
+	if (strcmp(arg, "--align") == 0) {
+		options->align = 1;
+		return 0;
+	}
+
+	if (strcmp(arg, "--moves") == 0) {
+		options->moves = 1;
+		return 0;
+	}
+
+	if (strcmp(arg, "--make-signature") == 0) {
+		options->make_signature = 1;
+		return 0;
+	}
+
+	if (strncmp(arg, "--signature=", 12) == 0) {
+		if (arg[12] == 0) return 1;
+		options->signature_name = arg + 12;
+		return 0;
+	}
+
+	if (strcmp(arg, "--report") == 0 ||
+	    strcmp(arg, "--report=text") == 0) {
+		options->report = REPORT_TEXT;
+		return 0;
+	}
+
+	if (strcmp(arg, "--report=json") == 0) {
+		options->report = REPORT_JSON;
+		return 0;
+	}
+
+	if (strncmp(arg, "--report-bytes=", 15) == 0) {
+		options->report_bytes = strtoul(arg + 15, &end, 10);
+		if (end == arg + 15 || *end != 0) return 1;
+		return 0;
+	}
+
+	if (strncmp(arg, "--scan-memory=", 14) == 0) {
+		options->scan_memory = strtoul(arg + 14, &end, 10) * 1024;
+		if (end == arg + 14 || *end != 0 ||
+		    options->scan_memory < MIN_SCAN_MEMORY) return 1;
+		return 0;
+	}
+
+	if (strncmp(arg, "--threads=", 10) == 0) {
+		options->threads = (int) strtol(arg + 10, &end, 10);
+		if (end == arg + 10 || *end != 0 || options->threads < 1)
+			return 1;
+		return 0;
+	}
+
+	return 1;
+}
+
 int main(int argc, char **argv)
 {
 	struct file file_one, file_two;
-	unsigned long largest_file_size;
+	struct options options;
+	hex_offset largest_file_size;
+	char *names[2], *invalid = NULL;
+	int i, name_count = 0, failure = 1, status = 0;
+	FILE *errors = stdout;
 	char *message[] = {
 		"Arguments missing.\n",
-		"Usage:\n  hexcompare file1 [file2]\n",
-		"Failed to open file \"%s\".\n"
+		"Usage:\n  hexcompare [options] file1 [file2]\n\n"
+		"Options:\n"
+		"  --scan-memory=KIB  memory used by the overview scan "
+		"(default 4096)\n"
+		"  --threads=N        threads used by the overview scan "
+		"(default: one per core)\n"
+		"  --no-index         neither reuse nor save the index of "
+		"differences\n"
+		"  --report[=json]    print the differing ranges instead of "
+		"displaying them\n"
+		"  --report-bytes=N   bytes of each range to print "
+		"(default 0)\n",
+		"Failed to open file \"%s\".\n",
+		"Invalid option \"%s\".\n",
+		"\nKeys of the display:\n"
+		"  q                  quit\n"
+		"  n, p               jump to the next or previous "
+		"difference\n"
+		"  m                  show the bytes in hex or in ASCII\n"
+		"  v                  switch between the overview and the "
+		"full hex view\n",
+		"  --align            line the files up across insertions "
+		"and deletions\n"
+		"  --moves            look for data moved from one place to "
+		"another\n"
+		"  --make-signature   write the signature of file1 to file2\n"
+		"  --signature=FILE   compare file1 with the file that FILE "
+		"is the signature of\n",
+		"  d                  show the bytes inserted, deleted and "
+		"changed\n"
+		"  a                  follow the alignment or the offsets, "
+		"with --align\n"
+		"  c                  jump to where the top row was moved, "
+		"with --moves\n"
+		"  b                  show one or two blocks in each cell of "
+		"the overview\n"
+		"  i                  show or hide the performance overlay\n",
+		"\"%s\" is not a signature, or a damaged one or one of "
+		"another version.\n",
+		"A signature cannot be used with --align or --moves.\n",
+		"Failed to write the signature \"%s\".\n",
+		"The signature \"%s\" would overwrite the file it signs.\n"
 	};
 
+	/* Set the defaults. */
+	options.scan_memory = DEFAULT_SCAN_MEMORY;
+	options.threads = default_threads();
+	options.use_index = 1;
+	options.report = REPORT_NONE;
+	options.report_bytes = 0;
+	options.align = 0;
+	options.moves = 0;
+	options.make_signature = 0;
+	options.signature_name = NULL;
+	options.signature = NULL;
+
+	/* Separate the options from the file names. */
+	for (i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--", 2) == 0) {
+			if (parse_option(argv[i], &options) != 0 &&
+			    invalid == NULL) invalid = argv[i];
+		} else if (name_count < 2) {
+			names[name_count++] = argv[i];
+		}
+	}
+
+	/* A report keeps stdout for its output, and exits with a status of
+	   its own on errors, so that they are not taken for differences. */
+	if (options.report != REPORT_NONE) {
+		errors = stderr;
+		failure = REPORT_EXIT_ERROR;
+	}
+
+	if (invalid != NULL) {
+		fprintf(errors, message[3], invalid);
+		fprintf(errors, "%s%s%s%s", message[1], message[5],
+		        message[4], message[6]);
+		return failure;
+	}
+
 	/* Verify that we have enough input arguments. */
-	if (argc < 2) {
-		puts("hexcompare v" PVER "\n");
-		printf("%s%s", message[0], message[1]);
-		return 1;
+	if (name_count < 1) {
+		fputs("hexcompare v" PVER "\n\n", errors);
+		fprintf(errors, "%s%s%s%s%s", message[0], message[1],
+		        message[5], message[4], message[6]);
+		return failure;
+	}
+
+	/* A signature is written to the second name, and one that is read
+	   takes its place. */
+	if ((options.make_signature && name_count < 2) ||
+	    (options.signature_name != NULL &&
+	     (name_count > 1 || options.make_signature))) {
+		fprintf(errors, "%s%s%s%s%s", message[0], message[1],
+		        message[5], message[4], message[6]);
+		return failure;
 	}
 
 	/* Load in the file names. */
-	file_one.name = argv[1];
-	if (argc == 2) {
-		file_two.name = argv[1];
+	file_one.name = names[0];
+	if (options.signature_name != NULL) {
+		file_two.name = options.signature_name;
+	} else if (name_count == 1) {
+		file_two.name = names[0];
 	} else {
-		file_two.name = argv[2];
+		file_two.name = names[1];
 	}
 
 	/* Open the files.
 	   Present the user with an error message if they cannot be opened. */
-	if ((file_one.pointer = fopen(file_one.name, "rb")) == NULL) {
-		printf(message[2], file_one.name);
-		return 1;
+	if (open_file(&file_one) != 0) {
+		fprintf(errors, message[2], file_one.name);
+		return failure;
 	}
-	if ((file_two.pointer = fopen(file_two.name, "rb")) == NULL) {
-		printf(message[2], file_two.name);
-		fclose(file_one.pointer);
-		return 1;
+	if (options.make_signature) {
+		status = write_signature(&file_one, names[1],
+		                         options.scan_memory);
+		if (status != 0)
+			fprintf(errors, message[(status == 2) ? 10 : 9],
+			        names[1]);
+		close_file(&file_one);
+		return (status != 0) ? failure : 0;
+	}
+	if (open_file(&file_two) != 0) {
+		fprintf(errors, message[2], file_two.name);
+		close_file(&file_one);
+		return failure;
 	}
 
-	/* Get the file size */
-	fseek(file_one.pointer, 0, SEEK_END);
-	file_one.size = ftell(file_one.pointer);
+	/* A signature stands in for the file it was made from, which has
+	   no bytes to show here, and no index to be kept under. */
+	if (options.signature_name != NULL) {
+		status = load_signature(&file_two, &options.signature);
+		if (status <= 0 || options.align || options.moves) {
+			fprintf(errors, message[(status <= 0) ? 7 : 8],
+			        file_two.name);
+			close_file(&file_one);
+			close_file(&file_two);
+			free_signature(options.signature);
+			return failure;
+		}
+		status = 0;
+		close_file(&file_two);
+		file_two.size = 0;
+		options.use_index = 0;
+	}
 
-	fseek(file_two.pointer, 0, SEEK_END);
-	file_two.size = ftell(file_two.pointer);
+	/* Pick the comparison and fingerprint kernels that suit this
+	   processor. */
+	init_compare();
+	init_fingerprint();
 
 	/* Determine the largest file size */
 	largest_file_size = (file_one.size > file_two.size) ? file_one.size
 	                    : file_two.size;
+	if (options.signature != NULL &&
+	    options.signature->size > largest_file_size)
+		largest_file_size = options.signature->size;
 
-	/* Initiate the GUI display. */
-	start_gui(&file_one, &file_two, largest_file_size);
+	/* Initiate the GUI display, or report the differences without
+	   it. */
+	if (options.report != REPORT_NONE) {
+		status = run_report(&file_one, &file_two, &options);
+	} else {
+		start_gui(&file_one, &file_two, largest_file_size, &options);
+	}
 
 	/* Close the files. */
-	fclose(file_one.pointer);
-	fclose(file_two.pointer);
+	close_file(&file_one);
+	close_file(&file_two);
+	free_signature(options.signature);
 
 	/* Clean exit. */
-	return 0;
+	return status;
 }
@@ -0,0 +1,237 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include "prefetch.h"
+#include "fileio.h"
+
+#ifdef HEX_POSIX
+#include <pthread.h>
+
+/* Reads the bytes around the hex view in the background, so that they
+   are in the page cache by the time the view scrolls to them. The bytes
+   read form a single range around the screen, which grows towards
+   PREFETCH_SCREENS screens on either side, the way the view last moved
+   first. The page cache holds the data; the prefetcher itself only
+   keeps a buffer of PREFETCH_PIECE bytes to read into. */
+struct prefetch {
+	struct file_view views[2];  /* Views of its own on the files    */
+	int files;                  /* How many files it reads          */
+	unsigned char *buffer;      /* Where the bytes are read into    */
+	hex_offset size;            /* Size of the largest file         */
+	hex_offset low, high;       /* Range to have read               */
+	hex_offset start, end;      /* Range read so far                */
+	int direction;              /* Way the view last moved          */
+	int stop;                   /* Asks the thread to finish        */
+	pthread_t thread;
+	pthread_mutex_t lock;       /* Protects the fields above        */
+	pthread_cond_t wake;        /* Signalled on requests            */
+};
+
+/* #####################################################################
+   ##                     READING AHEAD                               ##
+   ##################################################################### */
+
+/* Picks the next piece to read, next to the range read so far. Returns
+   0 if the range to read is covered. */
+static int next_piece(struct prefetch *prefetch, hex_offset *start,
+                      hex_offset *end)
+{
+	int forward = (prefetch->end < prefetch->high);
+	int backward = (prefetch->start > prefetch->low);
+
+	if (forward && (prefetch->direction >= 0 || !backward)) {
+		*start = prefetch->end;
+		*end = (prefetch->high - *start > PREFETCH_PIECE)
+		       ? *start + PREFETCH_PIECE : prefetch->high;
+		return 1;
+	}
+	if (backward) {
+		*end = prefetch->start;
+		*start = (*end - prefetch->low > PREFETCH_PIECE)
+		         ? *end - PREFETCH_PIECE : prefetch->low;
+		return 1;
+	}
+	return 0;
+}
+
+static void *prefetch_worker(void *argument)
+{
+	struct prefetch *prefetch = argument;
+	hex_offset start, end;
+	int i;
+
+	pthread_mutex_lock(&prefetch->lock);
+	while (!prefetch->stop) {
+		if (!next_piece(prefetch, &start, &end)) {
+			pthread_cond_wait(&prefetch->wake, &prefetch->lock);
+			continue;
+		}
+
+		/* Read the piece of both files without holding the lock,
+		   then add it to the range if the view has not moved away
+		   from it in the meantime. */
+		pthread_mutex_unlock(&prefetch->lock);
+		for (i = 0; i < prefetch->files; i++) {
+			advise_file(prefetch->views[i].file, start,
+			            end - start, ADVISE_WILLNEED);
+			copy_view(&prefetch->views[i], start, prefetch->buffer,
+			          (unsigned long) (end - start));
+		}
+		pthread_mutex_lock(&prefetch->lock);
+
+		if (start == prefetch->end) prefetch->end = end;
+		else if (end == prefetch->start) prefetch->start = start;
+	}
+	pthread_mutex_unlock(&prefetch->lock);
+
+	return NULL;
+}
+
+/* #####################################################################
+   ##                   RUNNING THE PREFETCHER                        ##
+   ##################################################################### */
+
+/* Starts reading ahead of the hex view of both files in the background,
+   or of file one alone if file_two is NULL. Returns NULL if no thread
+   could be started. */
+struct prefetch *start_prefetch(struct file *file_one,
+                                struct file *file_two,
+                                hex_offset largest_file_size)
+{
+	struct prefetch *prefetch = malloc(sizeof(struct prefetch));
+
+	if (prefetch == NULL) return NULL;
+	prefetch->buffer = malloc(PREFETCH_PIECE);
+	if (prefetch->buffer == NULL) {
+		free(prefetch);
+		return NULL;
+	}
+
+	init_view(&prefetch->views[0], file_one, PREFETCH_PIECE,
+	          ADVISE_RANDOM);
+	prefetch->files = 1;
+	if (file_two != NULL) {
+		init_view(&prefetch->views[1], file_two, PREFETCH_PIECE,
+		          ADVISE_RANDOM);
+		prefetch->files = 2;
+	}
+	prefetch->size = largest_file_size;
+	prefetch->low = prefetch->high = 0;
+	prefetch->start = prefetch->end = 0;
+	prefetch->direction = 1;
+	prefetch->stop = 0;
+	pthread_mutex_init(&prefetch->lock, NULL);
+	pthread_cond_init(&prefetch->wake, NULL);
+
+	if (pthread_create(&prefetch->thread, NULL, prefetch_worker,
+	                   prefetch) != 0) {
+		prefetch->stop = 1;
+		stop_prefetch(prefetch);
+		return NULL;
+	}
+
+	return prefetch;
+}
+
+/* Tells the prefetcher that the view now shows screen_size bytes from
+   offset on, having moved forward if direction is positive, or backward
+   if it is negative. The screen itself has been read already. */
+void request_prefetch(struct prefetch *prefetch, hex_offset offset,
+                      unsigned long screen_size, int direction)
+{
+	hex_offset reach = (hex_offset) screen_size * PREFETCH_SCREENS;
+	hex_offset end;
+
+	if (prefetch == NULL || offset >= prefetch->size) return;
+
+	pthread_mutex_lock(&prefetch->lock);
+
+	end = (prefetch->size - offset > screen_size)
+	      ? offset + screen_size : prefetch->size;
+	prefetch->low = (offset > reach) ? offset - reach : 0;
+	prefetch->high = (prefetch->size - end > reach)
+	                 ? end + reach : prefetch->size;
+	if (direction != 0) prefetch->direction = direction;
+
+	/* Keep what was read around the screen if it is still there, and
+	   within the range to read. Otherwise, start over from the
+	   screen. */
+	if (offset >= prefetch->start && end <= prefetch->end) {
+		if (prefetch->start < prefetch->low)
+			prefetch->start = prefetch->low;
+		if (prefetch->end > prefetch->high)
+			prefetch->end = prefetch->high;
+	} else {
+		prefetch->start = offset;
+		prefetch->end = end;
+	}
+
+	pthread_cond_signal(&prefetch->wake);
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+/* Stops the prefetcher, waiting for the piece it is reading, and
+   releases it. */
+void stop_prefetch(struct prefetch *prefetch)
+{
+	int i;
+
+	if (prefetch == NULL) return;
+
+	if (!prefetch->stop) {
+		pthread_mutex_lock(&prefetch->lock);
+		prefetch->stop = 1;
+		pthread_cond_signal(&prefetch->wake);
+		pthread_mutex_unlock(&prefetch->lock);
+		pthread_join(prefetch->thread, NULL);
+	}
+
+	pthread_cond_destroy(&prefetch->wake);
+	pthread_mutex_destroy(&prefetch->lock);
+	for (i = 0; i < prefetch->files; i++)
+		free_view(&prefetch->views[i]);
+	free(prefetch->buffer);
+	free(prefetch);
+}
+
+#else
+
+/* Without threads, there is nothing to read in the background. */
+struct prefetch *start_prefetch(struct file *file_one,
+                                struct file *file_two,
+                                hex_offset largest_file_size)
+{
+	(void) file_one;
+	(void) file_two;
+	(void) largest_file_size;
+	return NULL;
+}
+
+void request_prefetch(struct prefetch *prefetch, hex_offset offset,
+                      unsigned long screen_size, int direction)
+{
+	(void) prefetch;
+	(void) offset;
+	(void) screen_size;
+	(void) direction;
+}
+
+void stop_prefetch(struct prefetch *prefetch)
+{
+	(void) prefetch;
+}
+
+#endif
@@ -0,0 +1,33 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEX_PREFETCH
+#define HEX_PREFETCH
+
+#include "general.h"
+
+#define PREFETCH_SCREENS 4          /* Screens read ahead on either side */
+#define PREFETCH_PIECE (64UL * 1024) /* Bytes read at a time            */
+
+struct prefetch;
+
+struct prefetch *start_prefetch(struct file *file_one,
+                                struct file *file_two,
+                                hex_offset largest_file_size);
+void request_prefetch(struct prefetch *prefetch, hex_offset offset,
+                      unsigned long screen_size, int direction);
+void stop_prefetch(struct prefetch *prefetch);
+
+#endif
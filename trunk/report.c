@@ -0,0 +1,283 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "report.h"
+#include "fileio.h"
+#include "compare.h"
+#include "diffmap.h"
+#include "signature.h"
+
+/* A report compares the files in a single pass, and prints the ranges of
+   differing bytes in order, each as soon as it is known to be over. It
+   keeps nothing else, so that it runs in the same little memory whatever
+   the size of the files. Ranges are joined by join_range(), as are the
+   ones the display jumps between, so that a report lists the same ranges
+   as the display. */
+struct report {
+	struct file *file_one, *file_two;
+	struct options *options;
+	struct file_view peek_one;   /* Views used to print the bytes of */
+	struct file_view peek_two;   /* ranges, away from the scan       */
+	struct diff_range range;     /* Range not printed yet            */
+	int open;                    /* There is such a range            */
+	unsigned long range_count;   /* Ranges printed so far            */
+};
+
+/* #####################################################################
+   ##                       PRINTING RANGES                           ##
+   ##################################################################### */
+
+/* Prints a string as a JSON string literal. */
+static void print_json_string(const char *string)
+{
+	putchar('"');
+	for (; *string != 0; string++) {
+		unsigned char c = *string;
+		if (c == '"' || c == '\\') printf("\\%c", c);
+		else if (c < 0x20) printf("\\u%04x", c);
+		else putchar(c);
+	}
+	putchar('"');
+}
+
+/* Prints up to length bytes of a file from offset, in hex. Prints
+   nothing past the end of the file. */
+static void print_bytes(struct file_view *view, hex_offset offset,
+                        unsigned long length)
+{
+	const unsigned char *data;
+	unsigned long available, i;
+
+	while (length > 0) {
+		data = read_view(view, offset, length, &available);
+		if (available == 0) break;
+		for (i = 0; i < available; i++) printf("%02x", data[i]);
+		offset += available;
+		length -= available;
+	}
+}
+
+static void print_range(struct report *report)
+{
+	hex_offset offset = report->range.start;
+	hex_offset length = report->range.end - offset;
+	unsigned long shown = report->options->report_bytes;
+	char start[OFFSET_DIGITS], size[OFFSET_DIGITS];
+
+	if (shown > length) shown = (unsigned long) length;
+
+	if (report->options->report == REPORT_JSON) {
+		printf("%s\n    {\"offset\": %s, \"length\": %s",
+		       (report->range_count > 0) ? "," : "",
+		       format_offset(start, offset, 10, 0),
+		       format_offset(size, length, 10, 0));
+		if (shown > 0) {
+			printf(", \"one\": \"");
+			print_bytes(&report->peek_one, offset, shown);
+			printf("\", \"two\": \"");
+			if (report->options->signature == NULL)
+				print_bytes(&report->peek_two, offset, shown);
+			putchar('"');
+		}
+		putchar('}');
+	} else {
+		printf("0x%s %s", format_offset(start, offset, 16, 8),
+		       format_offset(size, length, 10, 0));
+		if (shown > 0) {
+			putchar(' ');
+			if (offset >= report->file_one->size)
+				putchar('-');
+			print_bytes(&report->peek_one, offset, shown);
+			putchar(' ');
+			if (offset >= report->file_two->size)
+				putchar('-');
+			if (report->options->signature == NULL)
+				print_bytes(&report->peek_two, offset, shown);
+		}
+		putchar('\n');
+	}
+
+	report->range_count++;
+}
+
+/* Adds the run of differing bytes [start, end) to the report. Runs come
+   in order; the pending range is printed once a run is found too far
+   from it to be joined. */
+static void add_range(struct report *report, hex_offset start,
+                      hex_offset end)
+{
+	if (report->open && join_range(&report->range, start, end)) return;
+	if (report->open) print_range(report);
+	report->range.start = start;
+	report->range.end = end;
+	report->open = 1;
+}
+
+/* #####################################################################
+   ##                     COMPARING THE FILES                         ##
+   ##################################################################### */
+
+/* Goes through both files, adding every run of differing bytes to the
+   report. Returns the offset it got to, which is short of the end of the
+   smallest file if one of them could not be read. The files are read a
+   view's capacity at a time, so that mapped views let go of the pages
+   they are done with. */
+static hex_offset compare_files(struct report *report,
+                                struct file_view *view_one,
+                                struct file_view *view_two)
+{
+	hex_offset offset = 0, end, wanted;
+	unsigned long done, run_end;
+
+	end = (report->file_one->size < report->file_two->size)
+	      ? report->file_one->size : report->file_two->size;
+
+	while (offset < end) {
+		const unsigned char *data_one, *data_two;
+		unsigned long available_one, available_two, length;
+
+		wanted = end - offset;
+		if (wanted > view_one->capacity) wanted = view_one->capacity;
+		data_one = read_view(view_one, offset, wanted, &available_one);
+		data_two = read_view(view_two, offset, wanted, &available_two);
+		length = (available_one < available_two) ? available_one
+		         : available_two;
+		if (length == 0) break;
+
+		for (done = 0; done < length; done = run_end) {
+			done += find_mismatch(data_one + done, data_two + done,
+			                      length - done);
+			if (done == length) break;
+			run_end = done + span_difference(data_one + done,
+			                                 data_two + done,
+			                                 length - done);
+			add_range(report, offset + done, offset + run_end);
+		}
+		offset += length;
+	}
+
+	return offset;
+}
+
+/* Goes through file one block by block, adding the blocks that do not
+   match the signature standing in for file two to the report, up to the
+   end of the largest of them. */
+static void check_signature(struct report *report,
+                            struct file_view *view_one, hex_offset largest)
+{
+	struct signature *signature = report->options->signature;
+	unsigned long block;
+	hex_offset start, end;
+
+	for (block = 0; (hex_offset) block * signature->block_size < largest;
+	     block++) {
+		start = (hex_offset) block * signature->block_size;
+		end = start + signature->block_size;
+		if (end > largest) end = largest;
+		if (!block_matches(signature, view_one, block))
+			add_range(report, start, end);
+	}
+}
+
+/* #####################################################################
+   ##                        MAIN FUNCTION                            ##
+   ##################################################################### */
+
+/* Compares both files without the display, and prints the ranges where
+   they differ as asked by options. Against a signature, the ranges are
+   made of whole blocks. Returns REPORT_EXIT_SAME, REPORT_EXIT_DIFFERENT
+   or REPORT_EXIT_ERROR. */
+int run_report(struct file *file_one, struct file *file_two,
+               struct options *options)
+{
+	struct report report;
+	struct file_view view_one, view_two;
+	hex_offset size_two, common, largest, reached;
+	char number[OFFSET_DIGITS];
+	int status;
+
+	report.file_one = file_one;
+	report.file_two = file_two;
+	report.options = options;
+	report.open = 0;
+	report.range_count = 0;
+	size_two = (options->signature != NULL) ? options->signature->size
+	           : file_two->size;
+	common = (file_one->size < size_two) ? file_one->size : size_two;
+	largest = (file_one->size > size_two) ? file_one->size : size_two;
+
+	/* A signature has no bytes of file two to read. */
+	init_view(&view_one, file_one, options->scan_memory / 2,
+	          ADVISE_SEQUENTIAL);
+	init_view(&report.peek_one, file_one, HEX_VIEW_SIZE, ADVISE_RANDOM);
+	advise_file(file_one, 0, file_one->size, ADVISE_SEQUENTIAL);
+	if (options->signature == NULL) {
+		init_view(&view_two, file_two, options->scan_memory / 2,
+		          ADVISE_SEQUENTIAL);
+		init_view(&report.peek_two, file_two, HEX_VIEW_SIZE,
+		          ADVISE_RANDOM);
+		advise_file(file_two, 0, file_two->size, ADVISE_SEQUENTIAL);
+	}
+
+	if (options->report == REPORT_JSON) {
+		printf("{\n  \"file_one\": {\"name\": ");
+		print_json_string(file_one->name);
+		printf(", \"size\": %s},\n  \"file_two\": {\"name\": ",
+		       format_offset(number, file_one->size, 10, 0));
+		print_json_string(file_two->name);
+		printf(", \"size\": %s},\n  \"ranges\": [",
+		       format_offset(number, size_two, 10, 0));
+	}
+
+	/* Compare what both files have, then whatever only the largest one
+	   has. */
+	if (options->signature != NULL) {
+		check_signature(&report, &view_one, largest);
+		reached = common;
+	} else {
+		reached = compare_files(&report, &view_one, &view_two);
+		if (reached == common && largest > common)
+			add_range(&report, common, largest);
+	}
+	if (report.open) print_range(&report);
+
+	if (options->report == REPORT_JSON) {
+		printf("%s],\n  \"range_count\": %lu,\n  \"complete\": %s\n}\n",
+		       (report.range_count > 0) ? "\n  " : "",
+		       report.range_count,
+		       (reached == common) ? "true" : "false");
+	}
+
+	if (reached < common) {
+		fprintf(stderr, "Failed to read the files at offset 0x%s.\n",
+		        format_offset(number, reached, 16, 0));
+		status = REPORT_EXIT_ERROR;
+	} else if (report.range_count > 0) {
+		status = REPORT_EXIT_DIFFERENT;
+	} else {
+		status = REPORT_EXIT_SAME;
+	}
+	if (fflush(stdout) != 0 || ferror(stdout))
+		status = REPORT_EXIT_ERROR;
+
+	free_view(&view_one);
+	free_view(&report.peek_one);
+	if (options->signature == NULL) {
+		free_view(&view_two);
+		free_view(&report.peek_two);
+	}
+	return status;
+}
@@ -0,0 +1,28 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEX_REPORT
+#define HEX_REPORT
+
+#include "general.h"
+
+#define REPORT_EXIT_SAME 0      /* The files are identical            */
+#define REPORT_EXIT_DIFFERENT 1 /* They differ somewhere               */
+#define REPORT_EXIT_ERROR 2     /* They could not be read in full      */
+
+int run_report(struct file *file_one, struct file *file_two,
+               struct options *options);
+
+#endif
@@ -0,0 +1,594 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "scan.h"
+#include "fileio.h"
+#include "diffmap.h"
+#include "compare.h"
+#include "fingerprint.h"
+#include "signature.h"
+
+#ifdef HEX_POSIX
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#else
+#include <time.h>
+#endif
+
+/* State shared by the workers of one scan. Workers claim batches of
+   DIFF_BATCH_CHUNKS chunks and write their bits into disjoint words of
+   the difference map, while the user interface keeps reading it. */
+struct scan {
+	struct file *file_one, *file_two;
+	struct diff_map *map;       /* Map being filled in             */
+	struct diff_map *previous;  /* Map of the files before, or NULL */
+	int unchanged;              /* File (0 or 1) as it was then    */
+	hex_offset *known[2];       /* Fingerprints of either file's
+	                               chunks known beforehand, or NULL */
+	struct signature *signature; /* Stands in for file two, or NULL */
+	unsigned long view_size;    /* Capacity of each worker's views */
+	unsigned long next_batch;   /* First batch not yet claimed     */
+	unsigned long batches_done; /* Batches compared so far         */
+	hex_offset bytes_done;      /* Bytes covered by those batches  */
+	double start_time;          /* When the scan was started       */
+	double finish_time;         /* When the last batch was done    */
+	volatile int cancel;        /* Asks the workers to give up     */
+	int threads;                /* Number of workers started       */
+#ifdef HEX_POSIX
+	pthread_t *workers;
+	pthread_mutex_t lock;       /* Protects the counters above     */
+#endif
+};
+
+/* #####################################################################
+   ##                     COMPARING ONE BATCH                         ##
+   ##################################################################### */
+
+/* Fingerprints the chunks of a file as its bytes go by, a piece at a
+   time. */
+struct printer {
+	hex_offset *prints;         /* Where the fingerprints go        */
+	hex_offset offset;          /* Offset of the next byte          */
+	hex_offset print;           /* Fingerprint of the chunk so far  */
+};
+
+static void start_printer(struct printer *printer, hex_offset *prints,
+                          hex_offset offset)
+{
+	printer->prints = prints;
+	printer->offset = offset;
+	printer->print = 0;
+}
+
+static void feed_printer(struct printer *printer, const unsigned char *data,
+                         unsigned long length)
+{
+	unsigned long room;
+
+	while (length > 0) {
+		room = DIFF_CHUNK_SIZE -
+		       (unsigned long) (printer->offset % DIFF_CHUNK_SIZE);
+		if (room > length) room = length;
+		printer->print = extend_fingerprint(printer->print, data, room);
+		printer->offset += room;
+		data += room;
+		length -= room;
+		if (printer->offset % DIFF_CHUNK_SIZE == 0) {
+			printer->prints[printer->offset / DIFF_CHUNK_SIZE - 1] =
+				printer->print;
+			printer->print = 0;
+		}
+	}
+}
+
+/* Records the fingerprint of the chunk the file ends in, if it ends
+   inside one. The chunks it does not reach keep the fingerprint of
+   nothing, 0. */
+static void finish_printer(struct printer *printer)
+{
+	if (printer->offset % DIFF_CHUNK_SIZE != 0)
+		printer->prints[printer->offset / DIFF_CHUNK_SIZE] =
+			printer->print;
+}
+
+/* Feeds the bytes of a file up to end to a printer. */
+static void print_range(struct printer *printer, struct file_view *view,
+                        hex_offset end)
+{
+	const unsigned char *data;
+	unsigned long available;
+
+	while (printer->offset < end) {
+		data = read_view(view, printer->offset,
+		                 end - printer->offset, &available);
+		if (available == 0) break;
+		feed_printer(printer, data, available);
+	}
+}
+
+/* Works out the bytes a batch covers. */
+static void batch_range(struct diff_map *map, unsigned long batch,
+                        hex_offset *offset, hex_offset *end)
+{
+	*offset = batch * DIFF_BATCH_SIZE;
+	*end = *offset + DIFF_BATCH_SIZE;
+	if (*end > map->size) *end = map->size;
+}
+
+/* Compares [offset, end) of both files, within a batch, and records the
+   runs of differing bytes in it. If printers are given, both files are
+   fingerprinted along the way. Returns 0 if the scan was cancelled
+   midway. */
+static int scan_range(struct scan *scan, struct file_view *view_one,
+                      struct file_view *view_two, unsigned long batch,
+                      hex_offset offset, hex_offset end,
+                      struct printer *printers)
+{
+	struct diff_map *map = scan->map;
+
+	/* Walk through the range as far as both views reach at a time. */
+	while (offset < end) {
+		const unsigned char *data_one, *data_two;
+		unsigned long available_one, available_two, length;
+		unsigned long done, run_end;
+
+		if (scan->cancel) return 0;
+
+		data_one = read_view(view_one, offset, end - offset,
+		                     &available_one);
+		data_two = read_view(view_two, offset, end - offset,
+		                     &available_two);
+		length = (available_one < available_two) ? available_one
+		         : available_two;
+
+		/* Past the end of one of the files, every byte differs.
+		   What is left of the other one still gets fingerprinted. */
+		if (length == 0) {
+			if (available_one != available_two)
+				mark_difference(map, batch, offset, end);
+			if (printers != NULL) {
+				print_range(&printers[0], view_one, end);
+				print_range(&printers[1], view_two, end);
+			}
+			break;
+		}
+		if (printers != NULL) {
+			feed_printer(&printers[0], data_one, length);
+			feed_printer(&printers[1], data_two, length);
+		}
+
+		/* Find the runs of differing bytes in what both views
+		   have in common. */
+		for (done = 0; done < length; done = run_end) {
+			done += find_mismatch(data_one + done, data_two + done,
+			                      length - done);
+			if (done == length) break;
+			run_end = done + span_difference(data_one + done,
+			                                 data_two + done,
+			                                 length - done);
+			mark_difference(map, batch, offset + done,
+			                offset + run_end);
+		}
+		offset += length;
+	}
+	return 1;
+}
+
+/* Compares a batch of both files, and fingerprints both along the way.
+   Returns 0 if the scan was cancelled midway. */
+static int compare_batch(struct scan *scan, struct file_view *view_one,
+                         struct file_view *view_two, unsigned long batch)
+{
+	struct printer printers[2];
+	hex_offset offset, end;
+
+	batch_range(scan->map, batch, &offset, &end);
+	start_printer(&printers[0], scan->map->prints_one, offset);
+	start_printer(&printers[1], scan->map->prints_two, offset);
+	if (!scan_range(scan, view_one, view_two, batch, offset, end,
+	                printers)) return 0;
+	finish_printer(&printers[0]);
+	finish_printer(&printers[1]);
+	return 1;
+}
+
+/* Fills in the fingerprints of a batch of both files, reading only the
+   files whose fingerprints are not known beforehand. */
+static void print_batch(struct scan *scan, struct file_view *view_one,
+                        struct file_view *view_two, unsigned long batch)
+{
+	struct diff_map *map = scan->map;
+	struct file_view *views[2];
+	struct printer printer;
+	hex_offset *prints[2], offset, end;
+	unsigned long chunk, last;
+	int side;
+
+	views[0] = view_one;
+	views[1] = view_two;
+	prints[0] = map->prints_one;
+	prints[1] = map->prints_two;
+	batch_range(map, batch, &offset, &end);
+	chunk = batch * DIFF_BATCH_CHUNKS;
+	last = (unsigned long) ((end + DIFF_CHUNK_SIZE - 1) / DIFF_CHUNK_SIZE);
+
+	for (side = 0; side < 2; side++) {
+		if (scan->known[side] != NULL) {
+			memcpy(prints[side] + chunk, scan->known[side] + chunk,
+			       sizeof(hex_offset) * (last - chunk));
+			continue;
+		}
+		start_printer(&printer, prints[side], offset);
+		print_range(&printer, views[side], end);
+		finish_printer(&printer);
+	}
+}
+
+/* Compares a batch of both files whose fingerprints are filled in, chunk
+   by chunk. Chunks with the same fingerprint in both files are the same,
+   and are not read; only the others are compared. Returns 0 if the scan
+   was cancelled midway. */
+static int compare_chunks(struct scan *scan, struct file_view *view_one,
+                          struct file_view *view_two, unsigned long batch)
+{
+	struct diff_map *map = scan->map;
+	hex_offset offset, end, chunk_end;
+	unsigned long chunk;
+
+	batch_range(map, batch, &offset, &end);
+	for (chunk = batch * DIFF_BATCH_CHUNKS; offset < end;
+	     chunk++, offset = chunk_end) {
+		chunk_end = offset + DIFF_CHUNK_SIZE;
+		if (chunk_end > end) chunk_end = end;
+		if (map->prints_one[chunk] == map->prints_two[chunk]) continue;
+		if (!scan_range(scan, view_one, view_two, batch, offset,
+		                chunk_end, NULL)) return 0;
+	}
+	return 1;
+}
+
+/* Checks the blocks of a batch of file one against the signature that
+   stands in for file two, and records the ones that differ as a whole.
+   Returns 0 if the scan was cancelled midway. */
+static int check_batch(struct scan *scan, struct file_view *view_one,
+                       unsigned long batch)
+{
+	struct diff_map *map = scan->map;
+	struct signature *signature = scan->signature;
+	unsigned long block, last;
+	hex_offset start, end;
+
+	block = (unsigned long) (batch * DIFF_BATCH_SIZE /
+	                         signature->block_size);
+	last = block + (unsigned long) (DIFF_BATCH_SIZE /
+	                                signature->block_size);
+	for (; block < last; block++) {
+		if (scan->cancel) return 0;
+		start = (hex_offset) block * signature->block_size;
+		if (start >= map->size) break;
+		end = start + signature->block_size;
+		if (end > map->size) end = map->size;
+		if (!block_matches(signature, view_one, block))
+			mark_difference(map, batch, start, end);
+	}
+	return 1;
+}
+
+/* Takes what the previous map found in a batch if the file that changed
+   since is still the same there, which the fingerprints of its chunks
+   tell. They must have been filled in already. Returns 0 if the batch
+   has to be compared. */
+static int reuse_batch(struct scan *scan, unsigned long batch)
+{
+	struct diff_map *map = scan->map, *previous = scan->previous;
+	hex_offset *prints, *previous_prints, offset, end, previous_end;
+	unsigned long chunk, last;
+
+	if (previous == NULL || batch >= previous->batch_count) return 0;
+
+	/* The batch must cover the same bytes as it did. */
+	batch_range(map, batch, &offset, &end);
+	batch_range(previous, batch, &offset, &previous_end);
+	if (end != previous_end) return 0;
+
+	prints = (scan->unchanged == 0) ? map->prints_two : map->prints_one;
+	previous_prints = (scan->unchanged == 0) ? previous->prints_two
+	                  : previous->prints_one;
+	chunk = batch * DIFF_BATCH_CHUNKS;
+	last = (unsigned long) ((end + DIFF_CHUNK_SIZE - 1) / DIFF_CHUNK_SIZE);
+	if (memcmp(prints + chunk, previous_prints + chunk,
+	           sizeof(hex_offset) * (last - chunk)) != 0) return 0;
+
+	copy_batch(map, previous, batch);
+	return 1;
+}
+
+/* #####################################################################
+   ##                        SCAN WORKERS                             ##
+   ##################################################################### */
+
+static void lock_scan(struct scan *scan)
+{
+#ifdef HEX_POSIX
+	pthread_mutex_lock(&scan->lock);
+#else
+	(void) scan;
+#endif
+}
+
+static void unlock_scan(struct scan *scan)
+{
+#ifdef HEX_POSIX
+	pthread_mutex_unlock(&scan->lock);
+#else
+	(void) scan;
+#endif
+}
+
+/* Hands out the next batch. Returns 0 when there is none left, or when
+   the scan is being cancelled. */
+static int claim_batch(struct scan *scan, unsigned long *batch)
+{
+	lock_scan(scan);
+	*batch = scan->next_batch;
+	if (*batch < scan->map->batch_count) scan->next_batch++;
+	unlock_scan(scan);
+	return (*batch < scan->map->batch_count && !scan->cancel);
+}
+
+/* Compares a batch and accounts for it. */
+static void scan_batch(struct scan *scan, struct file_view *view_one,
+                       struct file_view *view_two, unsigned long batch)
+{
+	hex_offset batch_bytes = DIFF_BATCH_SIZE;
+
+	if (scan->signature != NULL) {
+		if (!check_batch(scan, view_one, batch)) return;
+	} else if (scan->known[0] == NULL && scan->known[1] == NULL) {
+		if (!compare_batch(scan, view_one, view_two, batch)) return;
+	} else {
+		print_batch(scan, view_one, view_two, batch);
+		if (!reuse_batch(scan, batch) &&
+		    !compare_chunks(scan, view_one, view_two, batch)) return;
+	}
+	mark_batch_done(scan->map, batch);
+
+	lock_scan(scan);
+	scan->batches_done++;
+	if (batch == scan->map->batch_count - 1)
+		batch_bytes = scan->map->size - batch * batch_bytes;
+	scan->bytes_done += batch_bytes;
+	if (scan->batches_done == scan->map->batch_count)
+		scan->finish_time = current_time();
+	unlock_scan(scan);
+}
+
+#ifdef HEX_POSIX
+static void *scan_worker(void *argument)
+{
+	struct scan *scan = argument;
+	struct file_view view_one, view_two;
+	unsigned long batch;
+
+	/* Every worker reads through views of its own. */
+	init_view(&view_one, scan->file_one, scan->view_size,
+	          ADVISE_SEQUENTIAL);
+	init_view(&view_two, scan->file_two, scan->view_size,
+	          ADVISE_SEQUENTIAL);
+
+	while (claim_batch(scan, &batch))
+		scan_batch(scan, &view_one, &view_two, batch);
+
+	free_view(&view_one);
+	free_view(&view_two);
+	return NULL;
+}
+#endif
+
+/* #####################################################################
+   ##                       RUNNING A SCAN                            ##
+   ##################################################################### */
+
+/* Number of workers used when none is asked for: one per core. */
+int default_threads(void)
+{
+#ifdef HEX_POSIX
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cores > 0) return (int) cores;
+#endif
+	return 1;
+}
+
+/* Returns a monotonic-enough time in seconds, for measuring durations. */
+double current_time(void)
+{
+#ifdef HEX_POSIX
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec / 1000000.0;
+#else
+	return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* Returns the memory the process has resident, in bytes, or 0 where it
+   cannot be told. */
+hex_offset resident_memory(void)
+{
+	hex_offset resident = 0;
+#ifdef HEX_POSIX
+	unsigned long size, pages;
+	FILE *statm = fopen("/proc/self/statm", "r");
+
+	if (statm == NULL) return 0;
+	if (fscanf(statm, "%lu %lu", &size, &pages) == 2)
+		resident = (hex_offset) pages * sysconf(_SC_PAGESIZE);
+	fclose(statm);
+#endif
+	return resident;
+}
+
+/* Copies the fingerprints of a file's chunks, from a map of it with
+   another file, for as many chunks as map has. */
+static hex_offset *copy_prints(struct diff_map *map, hex_offset *prints,
+                               unsigned long count)
+{
+	hex_offset *copy = calloc(map->chunk_count + 1, sizeof(hex_offset));
+
+	if (count > map->chunk_count) count = map->chunk_count;
+	memcpy(copy, prints, sizeof(hex_offset) * count);
+	return copy;
+}
+
+/* Starts comparing both files in the background, filling in map as it
+   goes. The work is spread over the given number of threads, which
+   together never hold more than scan_memory bytes of file data in their
+   buffers. If a previous map of the files is given, from before the
+   other file than the unchanged one was modified, the batches where that
+   file is still the same are taken from it, and the unchanged file is
+   only read where the other one changed; the scan then owns it. The
+   fingerprints of the chunks of either file may also be known from a map
+   of it with a third file, with as many chunks as map: chunks are then
+   only read where they cannot be told the same by them, and the scan
+   owns those too. If a signature is given, file one is checked against
+   it instead, block by block, and file two is not read. */
+struct scan *start_scan(struct file *file_one, struct file *file_two,
+                        struct diff_map *map, unsigned long scan_memory,
+                        int threads, struct diff_map *previous,
+                        int unchanged, hex_offset *known_one,
+                        hex_offset *known_two, struct signature *signature)
+{
+	struct scan *scan = malloc(sizeof(struct scan));
+
+	scan->file_one = file_one;
+	scan->file_two = file_two;
+	scan->map = map;
+	scan->previous = previous;
+	scan->unchanged = unchanged;
+	scan->known[0] = known_one;
+	scan->known[1] = known_two;
+	if (previous != NULL && scan->known[unchanged] == NULL)
+		scan->known[unchanged] = copy_prints(map, (unchanged == 0) ?
+		                                     previous->prints_one :
+		                                     previous->prints_two,
+		                                     previous->chunk_count);
+	scan->signature = signature;
+	scan->next_batch = 0;
+	scan->batches_done = 0;
+	scan->bytes_done = 0;
+	scan->cancel = 0;
+	scan->start_time = current_time();
+	scan->finish_time = scan->start_time;
+
+	/* There is no point in starting more workers than there are
+	   batches to hand out, nor in having them read a handful of bytes
+	   at a time. */
+	if ((unsigned long) threads > map->batch_count)
+		threads = map->batch_count;
+	if ((unsigned long) threads > scan_memory / 2 / SCAN_MIN_VIEW_SIZE)
+		threads = scan_memory / 2 / SCAN_MIN_VIEW_SIZE;
+	if (threads < 1) threads = 1;
+	scan->view_size = scan_memory / 2 / threads;
+
+	advise_file(file_one, 0, file_one->size, ADVISE_SEQUENTIAL);
+	advise_file(file_two, 0, file_two->size, ADVISE_SEQUENTIAL);
+
+#ifdef HEX_POSIX
+	pthread_mutex_init(&scan->lock, NULL);
+	scan->workers = malloc(sizeof(pthread_t) * threads);
+	for (scan->threads = 0; scan->threads < threads; scan->threads++) {
+		if (pthread_create(&scan->workers[scan->threads], NULL,
+		                   scan_worker, scan) != 0) break;
+	}
+#else
+	scan->threads = 0;
+#endif
+
+	return scan;
+}
+
+/* Reports how far the scan is. Where there are no worker threads, this
+   is also where the scan makes progress, one batch per call. Returns 1
+   once the scan is finished. */
+int poll_scan(struct scan *scan, struct scan_progress *progress)
+{
+	int finished;
+
+	/* Without workers, do a batch of work here. */
+	if (scan->threads == 0) {
+		struct file_view view_one, view_two;
+		unsigned long batch;
+
+		if (claim_batch(scan, &batch)) {
+			init_view(&view_one, scan->file_one, scan->view_size,
+			          ADVISE_SEQUENTIAL);
+			init_view(&view_two, scan->file_two, scan->view_size,
+			          ADVISE_SEQUENTIAL);
+			scan_batch(scan, &view_one, &view_two, batch);
+			free_view(&view_one);
+			free_view(&view_two);
+		}
+	}
+
+	lock_scan(scan);
+	finished = (scan->batches_done == scan->map->batch_count);
+	if (progress != NULL) {
+		progress->bytes_done = scan->bytes_done;
+		progress->bytes_total = scan->map->size;
+		progress->seconds = (finished ? scan->finish_time
+		                     : current_time()) - scan->start_time;
+		progress->finished = finished;
+	}
+	unlock_scan(scan);
+
+	return finished;
+}
+
+/* Tells whether worker threads are running the scan. If not, it only
+   advances when poll_scan() is called. */
+int scan_in_background(struct scan *scan)
+{
+	return (scan->threads > 0);
+}
+
+/* Stops the scan, waiting for the workers to give up their current
+   batch, and releases it. If the scan was complete, the map is finished
+   off; otherwise the batches that were not compared stay unmarked. */
+void stop_scan(struct scan *scan)
+{
+	if (scan == NULL) return;
+
+	scan->cancel = 1;
+#ifdef HEX_POSIX
+	while (scan->threads > 0)
+		pthread_join(scan->workers[--scan->threads], NULL);
+	free(scan->workers);
+	pthread_mutex_destroy(&scan->lock);
+#endif
+	if (scan->batches_done == scan->map->batch_count &&
+	    !scan->map->complete)
+		finish_diff_map(scan->map);
+	free_diff_map(scan->previous);
+	free(scan->known[0]);
+	free(scan->known[1]);
+
+	/* The files will now be read at random. */
+	advise_file(scan->file_one, 0, scan->file_one->size, ADVISE_RANDOM);
+	advise_file(scan->file_two, 0, scan->file_two->size, ADVISE_RANDOM);
+	free(scan);
+}
@@ -0,0 +1,47 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEX_SCAN
+#define HEX_SCAN
+
+#include "general.h"
+#include "diffmap.h"
+
+#define SCAN_MIN_VIEW_SIZE 1024UL       /* Smallest buffer per worker   */
+
+struct scan;
+struct signature;
+
+/* How far along a scan is. */
+struct scan_progress {
+	hex_offset bytes_done;      /* Bytes of the files covered so far */
+	hex_offset bytes_total;     /* Bytes to cover in all             */
+	double seconds;             /* Time spent scanning               */
+	int finished;               /* All blocks have been compared     */
+};
+
+struct scan *start_scan(struct file *file_one, struct file *file_two,
+                        struct diff_map *map, unsigned long scan_memory,
+                        int threads, struct diff_map *previous,
+                        int unchanged, hex_offset *known_one,
+                        hex_offset *known_two, struct signature *signature);
+int poll_scan(struct scan *scan, struct scan_progress *progress);
+void stop_scan(struct scan *scan);
+int scan_in_background(struct scan *scan);
+int default_threads(void);
+double current_time(void);
+hex_offset resident_memory(void);
+
+#endif
@@ -0,0 +1,416 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "signature.h"
+#include "fileio.h"
+#include "diffmap.h"
+
+#ifdef HEX_POSIX
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* A signature lets a file be compared with one that lives elsewhere: it
+   is made where that file is, and only the signature is carried over. So
+   that it can be read on any machine, it is made of 64-bit words stored
+   least significant byte first, whatever the word size and byte order of
+   the machine that wrote it, and laid out as follows:
+
+     magic               SIGNATURE_MAGIC, 8 bytes
+     version             SIGNATURE_VERSION
+     block_size          Bytes in each block
+     size                Size of the file signed
+     block_count         Hashes that follow
+     hashes              block_count words, one per block
+
+   The hash of a block covers the bytes the file has in it, so the last
+   block of a file only matches a block of the same length. */
+#define SIGNATURE_WORD 8
+#define SIGNATURE_HEADER (8 + 4 * SIGNATURE_WORD)
+
+/* A 64-bit constant, put together from its halves, since C89 has no
+   suffix for one. Signatures are refused where hex_offset is narrower. */
+#define WIDE(high, low) (((hex_offset) (high) << 32) | (hex_offset) (low))
+
+/* The hash of a block is XXH64 with a seed of 0, which is the same on
+   every machine. hash.c cannot be used here: it is as wide as an
+   unsigned long and reads words in the byte order of the machine. */
+#define PRIME_1 WIDE(0x9E3779B1UL, 0x85EBCA87UL)
+#define PRIME_2 WIDE(0xC2B2AE3DUL, 0x27D4EB4FUL)
+#define PRIME_3 WIDE(0x165667B1UL, 0x9E3779F9UL)
+#define PRIME_4 WIDE(0x85EBCA77UL, 0xC2B2AE63UL)
+#define PRIME_5 WIDE(0x27D4EB2FUL, 0x165667C5UL)
+#define STRIPE (4 * SIGNATURE_WORD)
+#define EVEN_BYTES WIDE(0x00FF00FFUL, 0x00FF00FFUL)
+#define EVEN_PAIRS WIDE(0x0000FFFFUL, 0x0000FFFFUL)
+
+struct block_hash {
+	hex_offset lanes[4];            /* Running state of each lane    */
+	unsigned char stripe[STRIPE];   /* Bytes not yet mixed in        */
+	unsigned long stripe_length;    /* Number of such bytes          */
+	hex_offset length;              /* Bytes fed so far              */
+};
+
+/* Reads a word of length bytes, least significant byte first. */
+static hex_offset get_word(const unsigned char *bytes, int length)
+{
+	hex_offset word = 0;
+
+	while (length-- > 0) word = (word << 8) | bytes[length];
+	return word;
+}
+
+/* Reads a whole word, least significant byte first, in a single load,
+   turning its bytes around on machines that store the most significant
+   byte first. The test of the byte order folds away when compiled. This
+   is what the hash spends its time on, so get_word() is left for the
+   short words at the tail of a block. */
+static hex_offset read_word(const unsigned char *bytes)
+{
+	hex_offset word, one = 1;
+
+	if (sizeof(word) != SIGNATURE_WORD)
+		return get_word(bytes, SIGNATURE_WORD);
+	memcpy(&word, bytes, SIGNATURE_WORD);
+	if (*(unsigned char *) &one == 1) return word;
+	word = ((word & EVEN_BYTES) << 8) | ((word >> 8) & EVEN_BYTES);
+	word = ((word & EVEN_PAIRS) << 16) | ((word >> 16) & EVEN_PAIRS);
+	return (word << 32) | (word >> 32);
+}
+
+/* Stores a word, least significant byte first. */
+static void put_word(unsigned char *bytes, hex_offset word)
+{
+	int i;
+
+	for (i = 0; i < SIGNATURE_WORD; i++) {
+		bytes[i] = (unsigned char) (word & 0xFF);
+		word >>= 8;
+	}
+}
+
+static hex_offset rotate(hex_offset word, int bits)
+{
+	return (word << bits) | (word >> (64 - bits));
+}
+
+static hex_offset mix_word(hex_offset lane, hex_offset word)
+{
+	return rotate(lane + word * PRIME_2, 31) * PRIME_1;
+}
+
+static void start_block_hash(struct block_hash *hash)
+{
+	hash->lanes[0] = PRIME_1 + PRIME_2;
+	hash->lanes[1] = PRIME_2;
+	hash->lanes[2] = 0;
+	hash->lanes[3] = 0 - PRIME_1;
+	hash->stripe_length = 0;
+	hash->length = 0;
+}
+
+static void mix_stripe(struct block_hash *hash, const unsigned char *data)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		hash->lanes[i] = mix_word(hash->lanes[i],
+		                          read_word(data + i * SIGNATURE_WORD));
+	}
+}
+
+static void update_block_hash(struct block_hash *hash,
+                              const unsigned char *data,
+                              unsigned long length)
+{
+	unsigned long part;
+
+	hash->length += length;
+
+	/* Complete the stripe left over from the last piece. */
+	if (hash->stripe_length > 0) {
+		part = STRIPE - hash->stripe_length;
+		if (part > length) part = length;
+		memcpy(hash->stripe + hash->stripe_length, data, part);
+		hash->stripe_length += part;
+		data += part;
+		length -= part;
+		if (hash->stripe_length < STRIPE) return;
+		mix_stripe(hash, hash->stripe);
+		hash->stripe_length = 0;
+	}
+
+	for (; length >= STRIPE; data += STRIPE, length -= STRIPE)
+		mix_stripe(hash, data);
+
+	memcpy(hash->stripe, data, length);
+	hash->stripe_length = length;
+}
+
+static hex_offset finish_block_hash(struct block_hash *hash)
+{
+	const unsigned char *tail = hash->stripe;
+	unsigned long left = hash->stripe_length;
+	hex_offset result;
+	int i;
+
+	if (hash->length >= STRIPE) {
+		result = rotate(hash->lanes[0], 1) +
+		         rotate(hash->lanes[1], 7) +
+		         rotate(hash->lanes[2], 12) +
+		         rotate(hash->lanes[3], 18);
+		for (i = 0; i < 4; i++) {
+			result ^= mix_word(0, hash->lanes[i]);
+			result = result * PRIME_1 + PRIME_4;
+		}
+	} else {
+		result = PRIME_5;
+	}
+	result += hash->length;
+
+	for (; left >= 8; tail += 8, left -= 8) {
+		result ^= mix_word(0, read_word(tail));
+		result = rotate(result, 27) * PRIME_1 + PRIME_4;
+	}
+	if (left >= 4) {
+		result ^= get_word(tail, 4) * PRIME_1;
+		result = rotate(result, 23) * PRIME_2 + PRIME_3;
+		tail += 4;
+		left -= 4;
+	}
+	for (; left > 0; tail++, left--) {
+		result ^= *tail * PRIME_5;
+		result = rotate(result, 11) * PRIME_1;
+	}
+
+	result ^= result >> 33;
+	result *= PRIME_2;
+	result ^= result >> 29;
+	result *= PRIME_3;
+	result ^= result >> 32;
+	return result;
+}
+
+/* Hashes the bytes of a file in [offset, end). */
+static hex_offset hash_block(struct file_view *view, hex_offset offset,
+                             hex_offset end)
+{
+	const unsigned char *data;
+	unsigned long available;
+	struct block_hash hash;
+
+	start_block_hash(&hash);
+	while (offset < end) {
+		data = read_view(view, offset, end - offset, &available);
+		if (available == 0) break;
+		update_block_hash(&hash, data, available);
+		offset += available;
+	}
+	return finish_block_hash(&hash);
+}
+
+#ifdef HEX_POSIX
+
+/* Tells whether name is the opened file itself, under this name or
+   another. */
+static int same_file(struct file *file, const char *name)
+{
+	struct stat opened, named;
+
+	if (fstat(fileno(file->pointer), &opened) != 0 ||
+	    stat(name, &named) != 0) return 0;
+	return (opened.st_dev == named.st_dev &&
+	        opened.st_ino == named.st_ino);
+}
+
+/* Names the file a signature is written to before it is put in place,
+   beside it so that it can be renamed over it. */
+static char *temporary_name(const char *name)
+{
+	char *temporary = malloc(strlen(name) + 24);
+
+	if (temporary != NULL)
+		sprintf(temporary, "%s.%ld", name, (long) getpid());
+	return temporary;
+}
+
+#else
+
+/* Without inodes, only the same name can be told apart. */
+static int same_file(struct file *file, const char *name)
+{
+	return (strcmp(file->name, name) == 0);
+}
+
+/* Short names leave no room for a suffix, so a fixed name is used in
+   the same directory. */
+static char *temporary_name(const char *name)
+{
+	char *temporary = malloc(strlen(name) + 16);
+	unsigned long length;
+
+	if (temporary == NULL) return NULL;
+	for (length = strlen(name); length > 0; length--) {
+		if (name[length - 1] == '/' || name[length - 1] == '\\' ||
+		    name[length - 1] == ':') break;
+	}
+	memcpy(temporary, name, length);
+	strcpy(temporary + length, "HEXSIGN.TMP");
+	return temporary;
+}
+
+#endif
+
+/* Writes the signature of a file to the file called name, reading it
+   through with buffers of view_size bytes. The signature is written
+   aside and only replaces name once complete, so a failure leaves
+   whatever was there. Returns 0 on success, 1 if it could not be
+   written, or 2 if name is the file itself, which is left alone. */
+int write_signature(struct file *file, const char *name,
+                    unsigned long view_size)
+{
+	unsigned char header[SIGNATURE_HEADER], word[SIGNATURE_WORD];
+	unsigned long block, block_count;
+	struct file_view view;
+	char *temporary;
+	FILE *output;
+	int failed;
+
+	if (sizeof(hex_offset) < SIGNATURE_WORD) return 1;
+	if (same_file(file, name)) return 2;
+	temporary = temporary_name(name);
+	if (temporary == NULL) return 1;
+	output = fopen(temporary, "wb");
+	if (output == NULL) {
+		free(temporary);
+		return 1;
+	}
+
+	block_count = (unsigned long) ((file->size + SIGNATURE_BLOCK - 1) /
+	                               SIGNATURE_BLOCK);
+	memcpy(header, SIGNATURE_MAGIC, 8);
+	put_word(header + 8, SIGNATURE_VERSION);
+	put_word(header + 8 + SIGNATURE_WORD, SIGNATURE_BLOCK);
+	put_word(header + 8 + 2 * SIGNATURE_WORD, file->size);
+	put_word(header + 8 + 3 * SIGNATURE_WORD, block_count);
+	fwrite(header, SIGNATURE_HEADER, 1, output);
+
+	init_view(&view, file, view_size, ADVISE_SEQUENTIAL);
+	advise_file(file, 0, file->size, ADVISE_SEQUENTIAL);
+	for (block = 0; block < block_count; block++) {
+		hex_offset start = (hex_offset) block * SIGNATURE_BLOCK;
+
+		put_word(word, hash_block(&view, start,
+		                          start + SIGNATURE_BLOCK));
+		fwrite(word, SIGNATURE_WORD, 1, output);
+	}
+	free_view(&view);
+
+	failed = ferror(output);
+	if (fclose(output) != 0) failed = 1;
+#ifndef HEX_POSIX
+	/* rename() will not replace a file here. */
+	if (!failed) remove(name);
+#endif
+	if (failed || rename(temporary, name) != 0) {
+		remove(temporary);
+		failed = 1;
+	}
+	free(temporary);
+	return failed;
+}
+
+/* Tells whether an opened file is a signature, and loads it if so.
+   Returns 0 if it is not one, 1 if it is and was loaded into
+   *signature, or -1 if it is one that cannot be used here: a damaged
+   one, one of another version, or any where hex_offset is too narrow to
+   hold its words. */
+int load_signature(struct file *file, struct signature **signature)
+{
+	unsigned char header[SIGNATURE_HEADER], word[SIGNATURE_WORD];
+	hex_offset version, block_size, size, block_count, blocks;
+	struct signature *loaded;
+	unsigned long block;
+
+	if (file->size < SIGNATURE_HEADER) return 0;
+	rewind(file->pointer);
+	if (fread(header, SIGNATURE_HEADER, 1, file->pointer) != 1 ||
+	    memcmp(header, SIGNATURE_MAGIC, 8) != 0)
+		return 0;
+	if (sizeof(hex_offset) < SIGNATURE_WORD) return -1;
+
+	version = get_word(header + 8, SIGNATURE_WORD);
+	block_size = get_word(header + 8 + SIGNATURE_WORD, SIGNATURE_WORD);
+	size = get_word(header + 8 + 2 * SIGNATURE_WORD, SIGNATURE_WORD);
+	block_count = get_word(header + 8 + 3 * SIGNATURE_WORD,
+	                       SIGNATURE_WORD);
+
+	/* The blocks must fall in with the chunks and batches of the
+	   map. */
+	if (version != SIGNATURE_VERSION || block_size == 0 ||
+	    block_size % DIFF_CHUNK_SIZE != 0 ||
+	    DIFF_BATCH_SIZE % block_size != 0)
+		return -1;
+	blocks = size / block_size + (size % block_size != 0);
+	if (block_count != blocks || (unsigned long) blocks != blocks ||
+	    (file->size - SIGNATURE_HEADER) / SIGNATURE_WORD != blocks ||
+	    (file->size - SIGNATURE_HEADER) % SIGNATURE_WORD != 0)
+		return -1;
+
+	loaded = malloc(sizeof(struct signature));
+	if (loaded == NULL) return -1;
+	loaded->size = size;
+	loaded->block_size = (unsigned long) block_size;
+	loaded->block_count = (unsigned long) blocks;
+	loaded->hashes = malloc(sizeof(hex_offset) *
+	                        (loaded->block_count + 1));
+	if (loaded->hashes == NULL) {
+		free_signature(loaded);
+		return -1;
+	}
+	for (block = 0; block < loaded->block_count; block++) {
+		if (fread(word, SIGNATURE_WORD, 1, file->pointer) != 1) {
+			free_signature(loaded);
+			return -1;
+		}
+		loaded->hashes[block] = get_word(word, SIGNATURE_WORD);
+	}
+
+	*signature = loaded;
+	return 1;
+}
+
+void free_signature(struct signature *signature)
+{
+	if (signature == NULL) return;
+	free(signature->hashes);
+	free(signature);
+}
+
+/* Tells whether a block of the file seen through view is the same as in
+   the file signed. Past the end of both, blocks are the same. */
+int block_matches(struct signature *signature, struct file_view *view,
+                  unsigned long block)
+{
+	hex_offset start = (hex_offset) block * signature->block_size;
+
+	if (block >= signature->block_count)
+		return (start >= view->file->size);
+	return (hash_block(view, start, start + signature->block_size) ==
+	        signature->hashes[block]);
+}
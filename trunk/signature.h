@@ -0,0 +1,44 @@
+/*
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HEX_SIGNATURE
+#define HEX_SIGNATURE
+
+#include "general.h"
+#include "fileio.h"
+
+#define SIGNATURE_MAGIC "HEXSIGNS" /* First bytes of a signature file   */
+#define SIGNATURE_VERSION 2UL   /* Bumped whenever the layout changes   */
+#define SIGNATURE_BLOCK (64UL * 1024) /* Bytes summarized by one hash   */
+
+/* A file summarized by the hash of every SIGNATURE_BLOCK bytes, which
+   stands in for it where it is not at hand. Only the blocks that differ
+   can be told, not the bytes within them. */
+struct signature {
+	hex_offset size;             /* Size of the file signed           */
+	unsigned long block_size;    /* Bytes in each block               */
+	unsigned long block_count;   /* Blocks covering that size         */
+	hex_offset *hashes;          /* Hash of each block                */
+};
+
+int write_signature(struct file *file, const char *name,
+                    unsigned long view_size);
+int load_signature(struct file *file, struct signature **signature);
+void free_signature(struct signature *signature);
+int block_matches(struct signature *signature, struct file_view *view,
+                  unsigned long block);
+
+#endif